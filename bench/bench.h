@@ -0,0 +1,32 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/*
+	Minimal benchmark harness. A benchmark body runs its operation `iterations`
+	times; the harness picks the iteration count, repeats the body in batches and
+	reports percentiles of the batches' mean time per operation, and heap
+	allocations per operation.
+*/
+using BenchBody = std::function<void(std::size_t iterations)>;
+
+struct BenchRegistrar {
+	BenchRegistrar(const char* name, BenchBody body);
+};
+
+#define BENCHMARK(name) \
+	static void name(std::size_t iterations); \
+	static BenchRegistrar name##_registrar(#name, name); \
+	static void name(std::size_t iterations)
+
+// keeps the compiler from discarding a result
+template<class T>
+inline void do_not_optimize(const T& v)
+{
+	asm volatile("" : : "r,m"(v) : "memory");
+}
+
+#endif
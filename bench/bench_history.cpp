@@ -0,0 +1,103 @@
+#include "bench.h"
+#include "temp_history.h"
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace {
+// runs f on a few threads until destroyed
+class Background {
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> threads;
+public:
+	template<class F>
+	Background(unsigned count, F f)
+	{
+		for(unsigned i = 0; i < count; ++i)
+			threads.emplace_back([this, f]{
+				while( not stop.load(std::memory_order_relaxed) )
+					f();
+			});
+	}
+	~Background()
+	{
+		stop = true;
+		for(auto&& t : threads)
+			t.join();
+	}
+};
+
+void fill(TempHistory& h, std::size_t count)
+{
+	for(std::size_t i = 0; i < count; ++i)
+		h.append(1000000 + 2*i, 150 + std::sin(i / 50.0));
+}
+}
+
+BENCHMARK(history_append)
+{
+	static TempHistory h;
+	static std::size_t time = 1000000;
+	for(std::size_t i = 0; i < iterations; ++i, time += 2)
+		h.append(time, 150 + (i & 15) * 0.1);
+}
+
+BENCHMARK(history_samples_120)
+{
+	static TempHistory h;
+	static bool filled = (fill(h, 1800), true);
+	do_not_optimize(filled);
+	std::vector<TempSample> out;
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		out.clear();
+		do_not_optimize(h.samples(h.size() - 120, 120, out));
+	}
+}
+
+// the sensor appends while requests read
+BENCHMARK(history_samples_120_contended)
+{
+	static TempHistory h;
+	static bool filled = (fill(h, 1800), true);
+	do_not_optimize(filled);
+	static std::size_t time = 2000000;
+	static Background writer(1, []{h.append(time += 2, 150);});
+	std::vector<TempSample> out;
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		out.clear();
+		do_not_optimize(h.samples(h.size() - 120, 120, out));
+	}
+}
+
+BENCHMARK(history_range_1h_contended)
+{
+	static TempHistory h;
+	static bool filled = (fill(h, 1800), true);
+	do_not_optimize(filled);
+	static std::size_t time = 2000000;
+	static Background writer(1, []{h.append(time += 2, 150);});
+	TempHistory::Series series;
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		TempSample latest;
+		h.latest(latest);
+		do_not_optimize(h.range(latest.time - 3600, latest.time, series));
+	}
+}
+
+// readers hammering the history the sensor appends to
+BENCHMARK(history_append_contended)
+{
+	static TempHistory h;
+	static std::size_t time = 1000000;
+	static Background readers(3, []{
+			thread_local std::vector<TempSample> out;
+			out.clear();
+			h.samples(h.size() > 120 ? h.size() - 120 : 0, 120, out);
+		});
+	for(std::size_t i = 0; i < iterations; ++i, time += 2)
+		h.append(time, 150 + (i & 15) * 0.1);
+}
@@ -0,0 +1,154 @@
+#include "bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <vector>
+
+/*
+	build and run with `make bench` from the top of the repo. Results go to
+	bench/results/<commit>.tsv; `make bench-baseline` makes the current results
+	the baseline later runs are compared against.
+*/
+
+namespace {
+std::atomic<std::size_t> allocations{0};
+
+std::vector<std::pair<std::string, BenchBody>>& benchmarks()
+{
+	static std::vector<std::pair<std::string, BenchBody>> b;
+	return b;
+}
+
+// each batch gives one mean time per op; these are taken across the batches, so
+// they show how steady the batches were rather than the spread of single ops
+struct Result {
+	double p50 = 0;
+	double p90 = 0;
+	double max = 0;
+	double allocs = 0;
+};
+
+constexpr std::size_t Batches = 50;
+constexpr auto BatchTime = std::chrono::milliseconds(10);
+
+Result run(const BenchBody& body)
+{
+	using clock = std::chrono::steady_clock;
+	// grow the batch until it takes long enough to time reliably; this doubles as warm up
+	std::size_t iterations = 1;
+	for(;;)
+	{
+		auto start = clock::now();
+		body(iterations);
+		if( clock::now() - start >= BatchTime or iterations >= (std::size_t(1) << 30) )
+			break;
+		iterations *= 2;
+	}
+	std::vector<double> ns_per_op;
+	std::size_t allocs = 0;
+	for(std::size_t b = 0; b < Batches; ++b)
+	{
+		auto before = allocations.load(std::memory_order_relaxed);
+		auto start = clock::now();
+		body(iterations);
+		auto elapsed = clock::now() - start;
+		allocs += allocations.load(std::memory_order_relaxed) - before;
+		ns_per_op.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+	}
+	std::sort(ns_per_op.begin(), ns_per_op.end());
+	auto pct = [&](double p) {return ns_per_op[std::min(ns_per_op.size()-1, std::size_t(p * ns_per_op.size()))];};
+	return {pct(0.5), pct(0.9), ns_per_op.back(), double(allocs) / (Batches * iterations)};
+}
+
+std::map<std::string, Result> load(const std::string& file)
+{
+	std::map<std::string, Result> ret;
+	std::ifstream in(file);
+	std::string line;
+	std::getline(in, line); // header
+	while( std::getline(in, line) )
+	{
+		std::istringstream ss(line);
+		std::string name;
+		Result r;
+		if( ss >> name >> r.p50 >> r.p90 >> r.max >> r.allocs )
+			ret[name] = r;
+	}
+	return ret;
+}
+}
+
+BenchRegistrar::BenchRegistrar(const char* name, BenchBody body)
+{
+	benchmarks().push_back({name, std::move(body)});
+}
+
+void* operator new(std::size_t n)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if( void* p = std::malloc(n ? n : 1) )
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string filter, out_file, compare_file;
+	for(int arg = 1; arg < argc; ++arg)
+	{
+		std::string argstr = argv[arg];
+		if( arg+1 < argc and argstr == "--filter" )
+			filter = argv[++arg];
+		else if( arg+1 < argc and argstr == "--out" )
+			out_file = argv[++arg];
+		else if( arg+1 < argc and argstr == "--compare" )
+			compare_file = argv[++arg];
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " [--filter substring] [--out results.tsv] [--compare baseline.tsv]" << std::endl;
+			return -1;
+		}
+	}
+	auto baseline = compare_file.empty() ? std::map<std::string, Result>{} : load(compare_file);
+
+	std::ofstream out;
+	if( not out_file.empty() )
+	{
+		out.open(out_file);
+		out << "name\tbatch_p50_ns\tbatch_p90_ns\tbatch_max_ns\tallocs_per_op\n";
+	}
+	std::cout << "ns/op is the mean over each of " << Batches << " batches; p50, p90 and max are taken across the batches\n";
+	std::cout << std::left << std::setw(36) << "benchmark"
+		<< std::right << std::setw(12) << "p50 ns/op" << std::setw(12) << "p90" << std::setw(12) << "max"
+		<< std::setw(12) << "allocs/op" << std::setw(12) << "vs base" << "\n";
+	for(auto&& b : benchmarks())
+	{
+		if( b.first.find(filter) == std::string::npos )
+			continue;
+		auto r = run(b.second);
+		std::cout << std::left << std::setw(36) << b.first << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << r.p50 << std::setw(12) << r.p90 << std::setw(12) << r.max
+			<< std::setw(12) << std::setprecision(2) << r.allocs;
+		auto base = baseline.find(b.first);
+		if( base != baseline.end() and base->second.p50 > 0 )
+			std::cout << std::setw(11) << std::showpos << std::setprecision(1) << (r.p50 / base->second.p50 - 1) * 100 << "%" << std::noshowpos;
+		std::cout << std::endl;
+		if( out )
+			out << b.first << "\t" << r.p50 << "\t" << r.p90 << "\t" << r.max << "\t" << r.allocs << "\n";
+	}
+}
@@ -0,0 +1,130 @@
+#include "bench.h"
+#include "brewery_components.h"
+#include "crow_integration.h"
+#include "web_components.h"
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+// shaped like the real brewery, on pins the mock doesnt care about
+struct BenchTank : public ComponentTuple<FlowSensor, Heater, Valve, Pump, TempSensor, FlowSensor> {
+	BenchTank(std::string name, int pin_base) :
+		ComponentTuple(name,
+				std::make_tuple("input_flow", pin_base),
+				std::make_tuple("heater", 50, 200, pin_base+1),
+				std::make_tuple("reflow_valve", pin_base+2),
+				std::make_tuple("pump", pin_base+3),
+				std::make_tuple("temp", pin_base+4, "000000000000"),
+				std::make_tuple("output_flow", pin_base+5)
+			) {}
+};
+
+struct BenchBrewery : public ComponentTuple<BenchTank, BenchTank, BenchTank> {
+	BenchBrewery(std::string name) :
+		ComponentTuple(name, std::make_tuple("hlt", 100), std::make_tuple("mt", 110), std::make_tuple("bk", 120)) {}
+};
+
+struct Fixture {
+	BenchBrewery brewery{"brewery"};
+	SimpleApp app;
+	Fixture()
+	{
+		// an hour of samples; the sensor bus appends them on its next update
+		auto& t = temp();
+		std::vector<TempSample> samples;
+		auto now = time_in_seconds();
+		for(std::size_t i = 0; i < 1800; ++i)
+			samples.push_back({now - 3600 + 2*i, 150 + std::sin(i / 50.0)});
+		t.restore(samples);
+		while( t.getHistory().size() < samples.size() )
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		RouteTable routes;
+		registerEndpoints(brewery, routes, "");
+		app.mount(std::move(routes));
+		// make bench runs from the top of the repo
+		crow_mustache_set_base(".");
+	}
+	TempSensor& temp() {return brewery.get<0>().get<4>();}
+};
+
+Fixture& fixture()
+{
+	static Fixture f;
+	return f;
+}
+}
+
+BENCHMARK(json_history_columnar_120)
+{
+	auto& f = fixture();
+	TempSample latest;
+	f.temp().getHistory().latest(latest);
+	std::string buffer;
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		buffer.clear();
+		JSONWriter w(buffer);
+		generateHistory(f.temp(), latest.time - 239, latest.time, w);
+		do_not_optimize(buffer);
+	}
+}
+
+BENCHMARK(json_status_route_120)
+{
+	auto& f = fixture();
+	auto url = "/brewery/hlt/temp/status/" + std::to_string(f.temp().getHistory().size() - 120);
+	for(std::size_t i = 0; i < iterations; ++i)
+		do_not_optimize(f.app.dispatch(url));
+}
+
+BENCHMARK(route_dispatch_value)
+{
+	auto& f = fixture();
+	for(std::size_t i = 0; i < iterations; ++i)
+		do_not_optimize(f.app.dispatch("/brewery/hlt/heater/status"));
+}
+
+BENCHMARK(route_dispatch_not_found)
+{
+	auto& f = fixture();
+	for(std::size_t i = 0; i < iterations; ++i)
+		do_not_optimize(f.app.dispatch("/brewery/nothing/here"));
+}
+
+BENCHMARK(status_tree)
+{
+	auto& f = fixture();
+	std::string buffer;
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		buffer.clear();
+		JSONWriter w(buffer);
+		generateStatus(f.brewery, w);
+		do_not_optimize(buffer);
+	}
+}
+
+BENCHMARK(page_layout)
+{
+	auto& f = fixture();
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		do_not_optimize(generateLayout(f.brewery));
+		do_not_optimize(generateUpdateJS(f.brewery, {}));
+	}
+}
+
+BENCHMARK(page_render)
+{
+	auto& f = fixture();
+	for(std::size_t i = 0; i < iterations; ++i)
+	{
+		JSONWrapper ctx;
+		ctx.set("title", "brewery controller test");
+		ctx.set("asset_version", "0");
+		ctx.set("brewery_layout", generateLayout(f.brewery));
+		ctx.set("update_js", generateUpdateJS(f.brewery, {}));
+		do_not_optimize(crow_mustache_load("static_main.html", ctx));
+	}
+}
@@ -15,4 +15,5 @@ pkg_install() {
 }
 
 pkg_install libboost-all-dev
+pkg_install zlib1g-dev
 
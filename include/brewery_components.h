@@ -1,10 +1,18 @@
 #ifndef BREWERY_COMPONENTS_H__
 #define BREWERY_COMPONENTS_H__
 
-#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <thread>
 #include <string>
 #include <vector>
+#include "clock.h"
+#include "scheduler.h"
+#include "temp_history.h"
+#include "temp_sensor_bus.h"
 
 struct Named {
 	std::string name;
@@ -93,66 +101,56 @@ public:
 	void off() const;
 };
 
-struct RepeatThread {
-	bool finished = false;
-	unsigned ms_count = 0;
-	std::thread t;
-	template<class F>
-	RepeatThread(F f, unsigned ms_sleep_time) : t([=](){
-		while(!finished)
-		{
-			if( ms_count == 0 )
-				f();
-			++ms_count;
-			if( ms_count == ms_sleep_time )
-				ms_count = 0;
-			using namespace std::chrono_literals;
-			std::this_thread::sleep_for(1ms);
-		}
-	})
-	{}
-	~RepeatThread()
-	{
-		finished = true;
-		t.join();
-	}
-};
-
 std::size_t time_in_seconds();
 
 class TempSensor : public Named {
 	int pin_num;
-	std::size_t start_time;
-	// time in seconds since start of program -> temp in F
-	std::vector<std::pair<std::size_t,double>> tempHistory;
+	TempHistory tempHistory;
+	// taken by whatever writes the history; readers of the history never take it
 	std::mutex mut;
-	RepeatThread update_thread;
-	void update();
+	std::vector<std::function<void(const TempSample&)>> sampleListeners;
+	TempSensorBus::Subscription subscription; // last, starts sampling
+	void update(double tempF);
 public:
 	TempSensor(std::string name, int pin_num, const char* deviceId);
 	TempSensor(const TempSensor& rhs);
 	double getTempF();
-	friend class HistoryAccess;
-	class HistoryAccess {
-		TempSensor& t;
-	public:
-		HistoryAccess(TempSensor& t) : t{t} {t.mut.lock();}
-		auto operator [](unsigned i) {return t.tempHistory[i];}
-		std::size_t size() {return t.tempHistory.size();}
-		~HistoryAccess() {t.mut.unlock();}
-	};
-	HistoryAccess getHistory() {return {*this};}
-};
-
+	// safe to read from any thread while the sensor keeps sampling
+	const TempHistory& getHistory() const {return tempHistory;}
+	// called from the sampling thread with every new sample
+	void onSample(std::function<void(const TempSample&)> f);
+	// older samples, oldest first, put into the history straight away; dropped if
+	// live samples got there first, as the history cant take older ones after them
+	void restore(const std::vector<TempSample>& samples);
+};
+
+/*
+	Counts edges from the pin's interrupt thread, which is the only writer, so the
+	ISR path is a couple of plain atomic stores. The times of the most recent edges
+	are kept in a small ring for rate estimates.
+*/
 class CountEdges {
-	int edges;
+public:
+	using clock = Clock;
+	static constexpr std::size_t HistorySize = 64;
+private:
+	std::atomic<std::uint64_t> edges{0};
+	std::atomic<clock::rep> edge_times[HistorySize] = {}; // edge n lands in slot n % HistorySize
 	static void update(void* v);
 public:
 	CountEdges(int PinNum, int EdgeType);
 	CountEdges(const CountEdges&)=delete; // the ISR uses our address, so we cant move or copy
-	int getEdges() {
-		return edges;
+	std::uint64_t getEdges() const {
+		return edges.load(std::memory_order_acquire);
 	}
+	// unsigned arithmetic keeps this right even if the counter wraps
+	std::uint64_t edgesSince(std::uint64_t previous) const {
+		return getEdges() - previous;
+	}
+	// copies the times of up to max of the most recent edges, newest first, and returns how many
+	std::size_t recentEdgeTimes(clock::time_point* out, std::size_t max) const;
+	// from the last few edges inside the window, so it reaches zero at most window after they stop
+	double edgesPerSecond(clock::duration window) const;
 };
 
 template<class T>
@@ -164,16 +162,30 @@ struct ReadableValue : public Named {
 
 static constexpr auto LitersPerGallon = 3.785412;
 
+class FlowSensor;
+class FlowRate : public ReadableValue<double> {
+	FlowSensor& sensor;
+public:
+	FlowRate(std::string n, FlowSensor& sensor) : ReadableValue<double>(n), sensor(sensor) {}
+	virtual double get(); // gallons per minute
+};
+
 class FlowSensor : public ReadableValue<double> {
 	CountEdges sensor;
-	int initialEdgeCount = 0;
-	int edgeCount();
+	std::atomic<std::uint64_t> initialEdgeCount{0};
+	std::uint64_t edgeCount();
 	int EdgesPerLiter;
+	FlowRate rate;
 public:
+	static constexpr auto RateWindow = std::chrono::seconds(2);
 	void resetFlowCount();
 	FlowSensor(std::string n, int PinNum, int EdgesPerLiter=600);
 	double getFlowInLiters();
 	double getFlowInGallons();
+	double getRateInLitersPerMinute();
+	double getRateInGallonsPerMinute();
+	FlowRate& getRate() {return rate;}
+	const CountEdges& getEdgeCounter() const {return sensor;}
 	virtual double get();
 };
 
@@ -187,11 +199,18 @@ public:
 
 template<class T>
 class WriteableValue : public ReadableValue<T> {
-	T value{0};
+	std::atomic<T> value{0}; // set from request threads, read on the control thread
+	std::vector<std::function<void(T)>> changeListeners;
 public:
 	WriteableValue(std::string name, T v=0) : ReadableValue<T>(name), value(v) {}
-	virtual void set(T v) {value = v;}
-	virtual T get() override {return value;}
+	virtual void set(T v) {
+		value.store(v);
+		for(auto&& f : changeListeners)
+			f(v);
+	}
+	virtual T get() override {return value.load();}
+	// called with every new value; add listeners before the value can be set from other threads
+	void onChange(std::function<void(T)> f) {changeListeners.push_back(std::move(f));}
 };
 
 class Button : public WriteableValue<int> {
@@ -0,0 +1,59 @@
+#ifndef CLOCK_H__
+#define CLOCK_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <thread>
+
+/*
+	Time as the controller sees it: the steady clock, or a sped up version of it
+	when simulating, so a brew day can pass in minutes. Anything that schedules,
+	sleeps or timestamps goes through here rather than the std clocks.
+*/
+struct Clock {
+	using duration = std::chrono::steady_clock::duration;
+	using rep = duration::rep;
+	using period = duration::period;
+	using time_point = std::chrono::time_point<Clock>;
+	static constexpr bool is_steady = true;
+
+	static time_point now();
+	// wall clock seconds since the epoch, advancing at the same speed
+	static std::size_t epochSeconds();
+
+	// only call this before any other thread uses the clock
+	static void setSpeed(double speed);
+	static double getSpeed();
+	// how long d of clock time takes in real time
+	static std::chrono::steady_clock::duration toReal(duration d);
+	// clock milliseconds in which real_ms of real time pass, for periods that should
+	// keep to real time; at least 1, so it always works as a period
+	static unsigned fromRealMs(unsigned real_ms);
+
+	static void sleep_for(duration d)
+	{
+		std::this_thread::sleep_for(toReal(d));
+	}
+	template<class Lock>
+	static std::cv_status wait_until(std::condition_variable& cv, Lock& lk, time_point tp)
+	{
+		auto remaining = tp - now();
+		if( remaining > duration::zero() )
+			cv.wait_for(lk, toReal(remaining));
+		return now() >= tp ? std::cv_status::timeout : std::cv_status::no_timeout;
+	}
+
+	// while one of these is alive, now() on this thread returns t; lets the
+	// simulator deliver events stamped with the time they were meant to happen
+	class Frozen {
+		time_point t;
+		const time_point* previous;
+	public:
+		explicit Frozen(time_point t);
+		Frozen(const Frozen&)=delete;
+		~Frozen();
+	};
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CONTROL_LOOP_H__
+#define CONTROL_LOOP_H__
+
+#include "brewery_components.h"
+#include "histogram.h"
+#include "metrics.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Runs controllers on a single control thread, but only when something they
+	depend on changed: a new sample from a sensor or a new value of a setpoint.
+	A slow heartbeat also runs every controller, so a stalled sensor can't leave
+	an output stuck. Between events the thread just sleeps.
+*/
+class ControlLoop {
+public:
+	using clock = Clock;
+	using ControllerId = std::size_t;
+	struct ControllerStats {
+		std::string name;
+		std::size_t runs = 0;
+		std::chrono::microseconds last_latency{0}; // from being marked dirty to starting to run
+		std::chrono::microseconds max_latency{0};
+		std::chrono::microseconds last_runtime{0};
+		std::chrono::microseconds max_runtime{0};
+		LatencyHistogram latency_histogram;
+		LatencyHistogram runtime_histogram;
+	};
+private:
+	struct Controller {
+		std::function<void()> func;
+		bool dirty = false;
+		clock::time_point marked;
+		ControllerStats stats;
+		Histogram* latency_metric;
+		Histogram* runtime_metric;
+	};
+	std::mutex mut;
+	std::condition_variable cv;
+	std::vector<std::unique_ptr<Controller>> controllers; // indexed by id
+	clock::duration heartbeat;
+	bool finished = false;
+	std::thread thread; // last, so it starts once everything else is ready
+	void run();
+public:
+	explicit ControlLoop(clock::duration heartbeat=std::chrono::seconds(5));
+	ControlLoop(const ControlLoop&)=delete;
+	~ControlLoop();
+
+	ControllerId add(std::string name, std::function<void()> func);
+	// safe from any thread, even after stop
+	void markDirty(ControllerId id);
+	void dependsOn(ControllerId id, TempSensor& t);
+	template<class T>
+	void dependsOn(ControllerId id, WriteableValue<T>& w)
+	{
+		w.onChange([this, id](T) {markDirty(id);});
+	}
+	// joins the control thread; call before the components the controllers use go away
+	void stop();
+	std::vector<ControllerStats> stats();
+	// for adjusting the control thread's priority and affinity
+	std::thread::native_handle_type nativeHandle() {return thread.native_handle();}
+};
+
+#endif
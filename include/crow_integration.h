@@ -8,12 +8,20 @@ namespace crow {
 	}
 	class request;
 }
+#include "json_writer.h"
 #include <string>
+#include <string_view>
 #include <memory>
+#include <mutex>
 #include <functional>
+#include <utility>
+#include <vector>
+
+class RouteTable;
 
 void crow_mustache_set_base(std::string);
 
+// mustache context only; responses are written with JSONWriter
 class JSONWrapper {
 	struct Deleter {
 		void operator()(crow::json::wvalue*);
@@ -22,11 +30,7 @@ class JSONWrapper {
 public:
 	JSONWrapper();
 	JSONWrapper(const JSONWrapper&);
-	void set(std::string value);
-	void set(unsigned int, JSONWrapper);
 	void set(std::string id, std::string value);
-	void set(std::string id, JSONWrapper value);
-	std::string dump();
 	crow::json::wvalue& to_wvalue();
 	const crow::json::wvalue& to_wvalue() const;
 };
@@ -36,6 +40,13 @@ class CrowRequest {
 public:
 	CrowRequest(const crow::request&);
 	std::string url_params_get(std::string) const;
+	std::string get_header(std::string) const; // empty if not present
+};
+
+struct SimpleResponse {
+	int code = 200;
+	std::vector<std::pair<std::string, std::string>> headers;
+	std::string body;
 };
 
 std::string crow_mustache_load(std::string, JSONWrapper);
@@ -46,12 +57,37 @@ class SimpleApp {
 		void operator()(crow::Crow<>*);
 	};
 	std::unique_ptr<crow::Crow<>, Deleter> impl;
+	struct PushChannel;
+	std::shared_ptr<PushChannel> push_channel;
+	std::once_flag routes_validated;
+	std::vector<std::string> route_list;
 public:
 	SimpleApp();
 	void route_dynamic(std::string endPoint, std::function<std::string()> exec);
 	void route_dynamic(std::string endPoint, std::function<std::string(int)> exec);
 	void route_dynamic(std::string endPoint, std::function<std::string(std::string)> exec);
 	void route_dynamic(std::string endPoint, std::function<std::string(const CrowRequest&)> exec);
+	void route_dynamic(std::string endPoint, std::function<SimpleResponse(const CrowRequest&)> exec);
+	void route_dynamic(std::string endPoint, std::function<SimpleResponse(const CrowRequest&, std::string)> exec);
+	// JSON handlers write into a buffer kept per server thread, so building the
+	// response doesnt allocate once the buffer has grown to fit
+	void route_dynamic(std::string endPoint, std::function<void(JSONWriter&)> exec);
+	void route_dynamic(std::string endPoint, std::function<void(JSONWriter&, int)> exec);
+	void route_dynamic(std::string endPoint, std::function<void(JSONWriter&, std::string)> exec);
+	void route_dynamic(std::string endPoint, std::function<void(JSONWriter&, const CrowRequest&)> exec);
+	// serves every route in the table through one catch-all per top level name
+	// in it, like /brewery/<path>
+	void mount(RouteTable routes);
+
+	// websocket clients of /push get the latest message of every topic when they
+	// connect, then each new message as long as it differs from the last one
+	void push(const std::string& topic, std::string_view message);
+
+	// runs a GET of url through the routes without a connection, for benchmarks
+	// and tools; the routes are frozen on the first call, so register them all first
+	SimpleResponse dispatch(std::string url);
+	// every endpoint registered through route_dynamic, in order
+	const std::vector<std::string>& routes() const {return route_list;}
 
 	enum LogLevels {Debug};
 	void loglevel(LogLevels);
@@ -0,0 +1,167 @@
+#ifndef HEATER_CONTROL_H__
+#define HEATER_CONTROL_H__
+
+#include "brewery_components.h"
+#include "scheduler.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+	PID with a clamped output. The integral stops growing while the output is
+	saturated in the direction of the error (anti-windup), and the derivative
+	acts on the measurement rather than the error so a setpoint change doesn't
+	kick the output.
+*/
+class PIDController {
+public:
+	struct Gains {
+		double kp; // output per degree
+		double ki; // output per degree second
+		double kd; // output per degree per second
+	};
+	struct Terms {
+		double p = 0;
+		double i = 0;
+		double d = 0;
+		double output = 0;
+	};
+private:
+	Gains gains;
+	double out_min;
+	double out_max;
+	double last_measurement = 0;
+	bool primed = false;
+	Terms terms;
+public:
+	PIDController(Gains gains, double out_min=0, double out_max=1);
+	// dt in seconds since the previous measurement; 0 if only the setpoint moved
+	double update(double setpoint, double measurement, double dt);
+	void reset();
+	// the integral is kept in output units, so changing gains doesnt bump the output
+	void setGains(Gains g) {gains = g;}
+	Gains getGains() const {return gains;}
+	const Terms& getTerms() const {return terms;}
+};
+
+/*
+	Relay feedback autotune (Astrom-Hagglund): drives the output fully on below
+	setpoint-hysteresis and fully off above setpoint+hysteresis, then derives
+	gains from the amplitude and period of the resulting oscillation. Uses the
+	Tyreus-Luyben rules, which overshoot much less than Ziegler-Nichols.
+*/
+class RelayAutotune {
+public:
+	enum State {Idle, Running, Done, Failed};
+	static constexpr std::size_t MaxSeconds = 4*60*60;
+private:
+	State state = Idle;
+	double setpoint = 0;
+	double hysteresis = 0;
+	unsigned cycles = 0;
+	bool primed = false;
+	bool on = false;
+	std::size_t started = 0;
+	double peak_high = 0;
+	double peak_low = 0;
+	std::vector<double> highs;
+	std::vector<double> lows;
+	std::vector<std::size_t> rises; // when the measurement crossed above the band
+	double ultimate_gain = 0;
+	double ultimate_period = 0;
+	PIDController::Gains result{0, 0, 0};
+	void finish();
+public:
+	void start(double setpoint, double hysteresis=0.5, unsigned cycles=4);
+	void cancel() {state = Idle;}
+	// feed each new measurement; returns the relay output, 0 or 1
+	double update(double measurement, std::size_t time);
+	State getState() const {return state;}
+	PIDController::Gains getResult() const {return result;}
+	double getUltimateGain() const {return ultimate_gain;}
+	double getUltimatePeriod() const {return ultimate_period;} // seconds
+};
+
+/*
+	Turns a 0..1 duty into on/off switching of a slow output (an SSR or relay
+	pin): on for duty*window at the start of each window, off for the rest.
+	Switching is done from a scheduler task at the given resolution, and the
+	output is left off once this is destroyed.
+*/
+class TimeProportionedOutput {
+	std::function<void(bool)> output;
+	Scheduler::clock::duration window;
+	std::atomic<double> duty{0};
+	// only touched by tick
+	Scheduler::clock::time_point window_start;
+	bool started = false;
+	bool is_on = false;
+	std::unique_ptr<PeriodicTask> task;
+	void tick();
+public:
+	TimeProportionedOutput(std::string name, std::function<void(bool)> output, unsigned ms_window=10000, unsigned ms_resolution=250, Scheduler& sched=Scheduler::global());
+	TimeProportionedOutput(const TimeProportionedOutput&)=delete;
+	~TimeProportionedOutput();
+	void setDuty(double d);
+	double getDuty() const {return duty.load();}
+};
+
+/*
+	Holds a Heater's temperature at its target using a TempSensor, a PID and a
+	time proportioned output. update is meant for the control loop and should
+	run whenever the sensor has a new sample or the target changes. If the
+	sensor stops producing samples the heater is switched off.
+*/
+class HeaterController : public Named {
+public:
+	enum Mode {Off, Auto, Autotune};
+	static constexpr std::size_t StaleSeconds = 30;
+	static constexpr PIDController::Gains DefaultGains{0.1, 0.0005, 0.5};
+	struct Status {
+		Mode mode;
+		bool stale;
+		double setpoint;
+		double temp;
+		double duty;
+		PIDController::Terms terms;
+		PIDController::Gains gains;
+		RelayAutotune::State autotune;
+	};
+private:
+	Heater& heater;
+	TempSensor& sensor;
+	std::mutex mut;
+	Mode mode = Auto;
+	bool stale = true;
+	double last_temp = 0;
+	std::size_t last_seq = 0;
+	std::size_t last_time = 0;
+	PIDController pid;
+	RelayAutotune autotune;
+	std::vector<std::function<void(PIDController::Gains)>> gainsListeners;
+	TimeProportionedOutput output; // last, drives the heater pin
+	void changeGains(PIDController::Gains g);
+public:
+	HeaterController(std::string name, Heater& heater, TempSensor& sensor, PIDController::Gains gains=DefaultGains, unsigned ms_window=10000);
+	HeaterController(const HeaterController&)=delete;
+	void update();
+
+	void setMode(Mode m);
+	Mode getMode();
+	void setGains(PIDController::Gains g);
+	PIDController::Gains getGains();
+	Status getStatus();
+	// called with the new gains whenever they are set or found by autotune; add listeners at startup
+	void onGainsChange(std::function<void(PIDController::Gains)> f);
+
+	// a negative gain turns the loop into positive feedback on the heater
+	static bool validGains(const PIDController::Gains& g);
+	static const char* modeName(Mode m);
+	static bool parseMode(const std::string& s, Mode& m);
+	static const char* autotuneStateName(RelayAutotune::State s);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef HISTOGRAM_H__
+#define HISTOGRAM_H__
+
+#include "json_writer.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+/*
+	Counts durations in power of two microsecond buckets: bucket 0 is under 1us,
+	bucket i is [2^(i-1), 2^i) us and the last bucket takes everything longer.
+	Cheap enough to update on every tick.
+*/
+struct LatencyHistogram {
+	static constexpr std::size_t Buckets = 24; // the last one starts at ~4 s
+	std::array<std::size_t, Buckets> counts{};
+
+	static std::size_t bucket(std::chrono::microseconds d)
+	{
+		std::size_t b = 0;
+		for(auto us = d.count(); us > 0 and b+1 < Buckets; us >>= 1)
+			++b;
+		return b;
+	}
+	void add(std::chrono::microseconds d) {++counts[bucket(d)];}
+	// as a JSON array of counts, trailing empty buckets left out
+	void toJSON(JSONWriter& w) const
+	{
+		std::size_t used = Buckets;
+		while( used > 0 and counts[used-1] == 0 )
+			--used;
+		w.beginArray();
+		for(std::size_t i = 0; i < used; ++i)
+			w.value(counts[i]);
+		w.endArray();
+	}
+};
+
+#endif
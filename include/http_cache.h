@@ -0,0 +1,66 @@
+#ifndef HTTP_CACHE_H__
+#define HTTP_CACHE_H__
+
+#include "crow_integration.h"
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+std::string gzip_compress(const std::string&);
+// strong validator derived from the content itself
+std::string make_etag(const std::string&);
+
+/*
+	A response body prepared once: its ETag and gzip variant are computed up
+	front so serving it is just picking a string.
+*/
+class CachedContent {
+	std::string content_type;
+	std::string cache_control;
+	std::string body;
+	std::string gzipped;
+	std::string etag;
+public:
+	CachedContent(std::string body, std::string content_type, std::string cache_control="no-cache");
+	// handles If-None-Match, Accept-Encoding and single byte Range requests
+	SimpleResponse respond(const CrowRequest&) const;
+	const std::string& getETag() const {return etag;}
+	const std::string& getBody() const {return body;}
+};
+
+/*
+	Rendered output of a template file, rendered again only when the file's
+	modification time changes.
+*/
+class CachedPage {
+	std::filesystem::path file;
+	std::function<std::string()> render;
+	std::string content_type;
+	std::mutex mut;
+	std::filesystem::file_time_type mtime;
+	std::shared_ptr<const CachedContent> content;
+public:
+	CachedPage(std::filesystem::path file, std::function<std::string()> render, std::string content_type="text/html");
+	std::shared_ptr<const CachedContent> get();
+};
+
+/*
+	Every file under a directory, loaded and compressed once at startup. Files are
+	served under a version shared by the whole table, so they can be cached by
+	clients forever; any change to them gives the next run a new version.
+	Identical files share one copy.
+*/
+class AssetTable {
+	std::map<std::string, std::shared_ptr<const CachedContent>> assets;
+	std::string version;
+public:
+	explicit AssetTable(std::filesystem::path dir);
+	const std::string& getVersion() const {return version;}
+	// path is "<version>/<file>"
+	SimpleResponse respond(const std::string& path, const CrowRequest&) const;
+};
+
+#endif
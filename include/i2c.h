@@ -1,14 +1,71 @@
 #ifndef I2C_H__
 #define I2C_H__
 
+#include "scheduler.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
 
 bool is_i2c_setup();
+// ids of the devices on the bus as of the last scan
 std::vector<std::string> get_i2c_devices();
 
+// pins are process wide, so every rig's probes need their own; a device can
+// only be mapped to one pin at a time
 bool setI2CDeviceForPin(int, std::string);
 std::string getI2CDeviceForPin(int);
+bool isI2CDeviceMapped(int);
+
+// has every sensor on the bus convert at once (w1_therm's therm_bulk_read), and waits
+// up to timeout_ms for them to finish. false if the kernel doesnt support it
+bool i2c_bulk_convert(unsigned timeout_ms);
+// last converted temperature of a device, without starting a new conversion when a
+// bulk conversion is pending
+bool read_i2c_temp_celsius(std::string device_id, double& celsius);
+
+/*
+	What is on the 1-wire bus, kept in memory so listing it never touches sysfs,
+	which stalls while the bus is busy. The kernel doesnt send inotify events
+	for w1 devices coming and going, so the bus is rescanned every few seconds
+	instead, and within a second of a listed device failing a read. Each device
+	keeps its last reading and how many reads failed.
+*/
+class I2CInventory {
+public:
+	struct Device {
+		std::string id; // without the family prefix, as the functions above take it
+		std::string family; // "28" for a DS18B20
+		bool have_reading = false;
+		double celsius = 0; // last good read
+		std::size_t read_time = 0;
+		std::size_t reads = 0;
+		std::size_t read_errors = 0;
+	};
+private:
+	std::mutex mut;
+	std::vector<Device> devices; // sorted by id
+	std::uint64_t version = 0;
+	std::atomic<bool> rescan_requested{false};
+	unsigned ticks = 0; // only touched by the rescan task
+	unsigned ticks_per_scan;
+	PeriodicTask rescan_task; // last, so it starts once everything else is ready
+	void tick();
+public:
+	// checks every ms_tick for a requested rescan, and rescans anyway every ticks_per_scan;
+	// a rescan lists the sysfs directory, so it belongs off the realtime workers
+	explicit I2CInventory(unsigned ms_tick=1000, unsigned ticks_per_scan=10, Scheduler& sched=Scheduler::io());
+	I2CInventory(const I2CInventory&)=delete;
+
+	void rescan();
+	// goes up whenever a device comes or goes
+	std::uint64_t getVersion();
+	std::uint64_t get(std::vector<Device>& out);
+	void recordRead(const std::string& id, bool ok, double celsius);
+
+	static I2CInventory& global();
+};
 
 #endif
 
@@ -0,0 +1,78 @@
+#ifndef JSON_WRITER_H__
+#define JSON_WRITER_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/*
+	Writes JSON straight into a caller's buffer, so a handler that reuses its
+	buffer doesnt allocate once the buffer has grown to fit. Numbers go out as
+	numbers; doubles in their shortest round trip form, and as null when they
+	arent finite.
+
+		w.beginObject().field("value", 1.5).key("points").beginArray();
+		...
+		w.endArray().endObject();
+
+	Commas are placed automatically; nesting isnt checked.
+*/
+class JSONWriter {
+	std::string& out;
+	bool need_comma = false;
+
+	void separate()
+	{
+		if( need_comma )
+			out += ',';
+	}
+	void writeInteger(std::int64_t);
+	void writeUnsigned(std::uint64_t);
+	void writeDouble(double);
+	void writeString(std::string_view);
+public:
+	explicit JSONWriter(std::string& out) : out(out) {}
+	JSONWriter(const JSONWriter&)=delete;
+
+	JSONWriter& beginObject() {separate(); out += '{'; need_comma = false; return *this;}
+	JSONWriter& endObject() {out += '}'; need_comma = true; return *this;}
+	JSONWriter& beginArray() {separate(); out += '['; need_comma = false; return *this;}
+	JSONWriter& endArray() {out += ']'; need_comma = true; return *this;}
+	JSONWriter& key(std::string_view k)
+	{
+		separate();
+		writeString(k);
+		out += ':';
+		need_comma = false;
+		return *this;
+	}
+
+	JSONWriter& value(bool v) {separate(); out += v ? "true" : "false"; need_comma = true; return *this;}
+	JSONWriter& value(double v) {separate(); writeDouble(v); need_comma = true; return *this;}
+	JSONWriter& value(std::string_view v) {separate(); writeString(v); need_comma = true; return *this;}
+	JSONWriter& value(const char* v) {return value(std::string_view(v));}
+	JSONWriter& value(const std::string& v) {return value(std::string_view(v));}
+	template<class T, std::enable_if_t<std::is_integral_v<T> and not std::is_same_v<T, bool>, int> = 0>
+	JSONWriter& value(T v)
+	{
+		separate();
+		if constexpr( std::is_signed_v<T> )
+			writeInteger(v);
+		else
+			writeUnsigned(v);
+		need_comma = true;
+		return *this;
+	}
+	JSONWriter& null() {separate(); out += "null"; need_comma = true; return *this;}
+	// already serialised JSON
+	JSONWriter& raw(std::string_view json) {separate(); out += json; need_comma = true; return *this;}
+
+	template<class T>
+	JSONWriter& field(std::string_view k, T&& v) {key(k); return value(std::forward<T>(v));}
+
+	std::string& buffer() {return out;}
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef MASH_SCHEDULE_H__
+#define MASH_SCHEDULE_H__
+
+#include "brewery_components.h"
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+	Runs a step mash on the control thread: for each step the heater's target
+	ramps (or jumps) to the step's temperature, and the hold timer starts once
+	the sensor reads within HoldBand of it. update is meant for the control
+	loop, and should also run about once a second so holds end on time.
+
+	Pausing freezes the ramp and the hold timer and leaves the heater where it
+	is. Setting the heater by hand during a step stops that step's ramp and
+	sticks until the next step.
+*/
+class MashSchedule : public Named {
+public:
+	enum State {Idle, Ramping, Holding, Done};
+	static constexpr double HoldBand = 1;
+	struct Step {
+		double temp;      // F
+		std::size_t hold; // seconds
+		double ramp;      // F per minute; 0 goes straight to temp
+	};
+	struct Status {
+		State state;
+		bool paused;
+		std::size_t step; // the one running, steps.size() once done
+		double setpoint;
+		double temp;
+		std::size_t hold_left; // seconds
+		std::vector<Step> steps;
+	};
+private:
+	Heater& heater;
+	const TempHistory& history;
+	std::mutex mut;
+	std::vector<Step> steps;
+	State state = Idle;
+	bool paused = false;
+	std::size_t step = 0;
+	std::size_t step_start = 0;
+	std::size_t hold_start = 0;
+	std::size_t paused_at = 0;
+	double ramp_from = 0;
+	double last_temp = 0;
+	bool have_temp = false;
+	double last_set = 0;
+	bool set_once = false; // forces each new step's first setpoint out
+	bool by_hand = false; // the heater was set by hand during this step
+	std::vector<std::function<void()>> commandListeners;
+	void begin(std::size_t index, std::size_t now);
+	double rampSetpoint(const Step& s, std::size_t now) const;
+	void setHeater(double v);
+	void commanded();
+public:
+	// history is the sensor in the vessel the heater heats
+	MashSchedule(std::string name, Heater& heater, const TempHistory& history);
+	MashSchedule(const MashSchedule&)=delete;
+	void update();
+
+	// false if a step's temperature is outside what the heater can be set to; its hold would never start
+	bool reachable(const std::vector<Step>& s);
+	// false while a schedule is running
+	bool setSteps(std::vector<Step> s);
+	// each returns false if there was nothing to do
+	bool start();
+	bool pause();
+	bool resume();
+	bool skip();
+	bool stop();
+	Status getStatus();
+	// called after each command, so the controller can run without waiting for its tick
+	void onCommand(std::function<void()> f);
+
+	static const char* stateName(State s);
+	// temp:minutes[:ramp],... with the ramp in F per minute
+	static bool parseSteps(const std::string& s, std::vector<Step>& out);
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include "brewery_components.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+	Counters and histograms cheap enough for hot paths: each is split into a few
+	cache line sized shards and a thread only ever bumps its own shard with a
+	relaxed atomic add, so recording never takes a lock or bounces a line between
+	cores. Shards are summed when the metrics are scraped.
+*/
+namespace Details {
+constexpr std::size_t MetricShards = 8;
+std::size_t metric_shard(); // fixed for the calling thread
+} /* namespace Details */
+
+class Counter {
+	struct alignas(64) Shard {
+		std::atomic<std::uint64_t> value{0};
+	};
+	Shard shards[Details::MetricShards];
+public:
+	void add(std::uint64_t n=1)
+	{
+		shards[Details::metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+	}
+	std::uint64_t value() const;
+};
+
+// power of two buckets: bucket 0 holds 0, bucket i holds [2^(i-1), 2^i), the last one everything larger
+class Histogram {
+public:
+	static constexpr std::size_t Buckets = 24;
+private:
+	struct alignas(64) Shard {
+		std::atomic<std::uint64_t> counts[Buckets] = {};
+		std::atomic<std::uint64_t> sum{0};
+	};
+	Shard shards[Details::MetricShards];
+	double scale;
+public:
+	// values are recorded as integers and multiplied by scale when exported
+	explicit Histogram(double scale=1) : scale(scale) {}
+	static std::size_t bucket(std::uint64_t v)
+	{
+		std::size_t b = v ? 64 - __builtin_clzll(v) : 0;
+		return b < Buckets ? b : Buckets-1;
+	}
+	void observe(std::uint64_t v)
+	{
+		auto& s = shards[Details::metric_shard()];
+		s.counts[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+		s.sum.fetch_add(v, std::memory_order_relaxed);
+	}
+	// in microseconds, so use a scale of 1e-6 to export seconds
+	template<class Rep, class Period>
+	void observe(std::chrono::duration<Rep, Period> d)
+	{
+		observe(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+	}
+	void write(std::string& out, const std::string& name, const std::string& labels) const;
+};
+
+/*
+	Names metrics and renders all of them in the Prometheus text format.
+	Registering takes a lock and is meant for startup; the returned references
+	stay valid for the life of the registry.
+*/
+class MetricsRegistry {
+public:
+	using Labels = std::vector<std::pair<std::string, std::string>>;
+private:
+	enum Type {CounterType, GaugeType, HistogramType};
+	struct Series {
+		std::string labels; // rendered, without the braces
+		std::unique_ptr<Counter> counter;
+		std::unique_ptr<Histogram> histogram;
+		std::function<double()> sample;
+	};
+	struct Family {
+		std::string help;
+		Type type;
+		std::vector<Series> series;
+	};
+	std::mutex mut;
+	std::map<std::string, Family> families;
+	Series& series(const std::string& name, const std::string& help, Type type, const Labels& labels);
+public:
+	Counter& counter(const std::string& name, const std::string& help, const Labels& labels={});
+	Histogram& histogram(const std::string& name, const std::string& help, double scale=1, const Labels& labels={});
+	// f is called on every scrape, from the scraping thread
+	void gauge(const std::string& name, const std::string& help, std::function<double()> f, const Labels& labels={});
+	void sampledCounter(const std::string& name, const std::string& help, std::function<double()> f, const Labels& labels={});
+
+	std::string exposition();
+
+	static MetricsRegistry& global();
+};
+
+/* Register Metrics */
+// exports the state of each component as gauges, labelled with its path
+template<class...Comps>
+void registerMetrics(ComponentTuple<Comps...>& ct, MetricsRegistry& reg, std::string pathPrefix)
+{
+	for_each_component(ct, [&](auto&& comp) {
+			registerMetrics(std::forward<decltype(comp)>(comp), reg, pathPrefix+"/"+ct.getName());
+		});
+}
+void registerMetrics(TempSensor& t, MetricsRegistry& reg, std::string pathPrefix);
+void registerMetrics(FlowSensor& f, MetricsRegistry& reg, std::string pathPrefix);
+template<class T>
+void registerMetrics(ReadableValue<T>& r, MetricsRegistry& reg, std::string pathPrefix)
+{
+	reg.gauge("brewery_component_value", "Current value of a component.",
+		[&r]{return static_cast<double>(r.get());},
+		{{"component", pathPrefix+"/"+r.getName()}});
+}
+
+#endif
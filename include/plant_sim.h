@@ -0,0 +1,105 @@
+#ifndef PLANT_SIM_H__
+#define PLANT_SIM_H__
+
+#include "clock.h"
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+	Stands in for the brewery's hardware in the MOCK build, behind the mock
+	wiringPi calls. Vessels are heated by their heater pin and lose heat to the
+	room; probes see a vessel through a dead time, a first order lag and noise,
+	like a ds18b20 in a thermowell; flow meters pulse their interrupt pin while
+	their pump and valve pins are all on. It all runs on Clock, so speeding the
+	clock up speeds up the brewery too.
+*/
+class PlantSim {
+public:
+	struct VesselConfig {
+		std::string name;
+		int heater_pin;
+		double heater_watts = 5500;
+		double liters = 40;
+		double start_celsius = 15;
+		double loss_watts_per_degree = 6; // to the room, through the walls and lid
+	};
+	struct ProbeConfig {
+		int pin; // what analogRead is called with
+		std::size_t vessel;
+		double dead_seconds = 2;
+		double lag_seconds = 8;
+		double noise_celsius = 0.05;
+	};
+	struct FlowConfig {
+		int pin; // the meter's interrupt pin
+		std::vector<int> enable_pins; // pump and valves that must all be on
+		double liters_per_minute = 8;
+		int edges_per_liter = 600;
+	};
+	using Isr = void(*)(void*);
+private:
+	struct PinState {
+		bool on = false;
+		Clock::time_point since;
+		double on_seconds = 0; // since the last step
+	};
+	struct Vessel {
+		VesselConfig config;
+		double celsius;
+	};
+	struct Probe {
+		ProbeConfig config;
+		std::deque<std::pair<Clock::time_point, double>> in_transit; // waiting out the dead time
+		double sensed;
+	};
+	struct Flow {
+		FlowConfig config;
+		double pending_edges = 0;
+	};
+	std::mutex mut;
+	std::map<int, PinState> pins;
+	std::map<int, std::pair<Isr, void*>> isrs;
+	std::vector<Vessel> vessels;
+	std::vector<Probe> probes;
+	std::vector<Flow> flows;
+	double ambient_celsius = 20;
+	std::mt19937 rng{12345};
+	Clock::time_point last_step;
+	bool running = false;
+	std::thread thread;
+
+	double takeOnSeconds(int pin, Clock::time_point now);
+	void step();
+public:
+	PlantSim()=default;
+	PlantSim(const PlantSim&)=delete;
+	~PlantSim();
+
+	// configure before start
+	std::size_t addVessel(VesselConfig v);
+	void addProbe(ProbeConfig p);
+	void addFlow(FlowConfig f);
+	void setAmbient(double celsius) {ambient_celsius = celsius;}
+
+	// steps the plant every real_step of real time, however fast the clock runs
+	void start(std::chrono::milliseconds real_step=std::chrono::milliseconds(10));
+	// no interrupts are delivered once this returns
+	void stop();
+
+	// for the mock wiringPi
+	void digitalWrite(int pin, int value);
+	int analogRead(int pin); // tenths of a degree C, like the ds18b20 node
+	void registerIsr(int pin, Isr f, void* data);
+
+	double vesselCelsius(std::size_t vessel);
+
+	static PlantSim& global();
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef REALTIME_H__
+#define REALTIME_H__
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/*
+	Helpers for running the control path with real-time guarantees. All of them
+	print why they failed (usually missing CAP_SYS_NICE / CAP_IPC_LOCK, so run
+	as root) and return false, leaving the process running as before.
+*/
+
+// locks all current and future memory, stops malloc from handing memory back to
+// the kernel, and touches heap_bytes of heap and stack_bytes of this thread's stack
+// so they are faulted in now rather than on the control path. threads started
+// afterwards get thread_stack_bytes of stack instead of the default (8MB on a pi),
+// all of which would be locked
+bool lock_memory(std::size_t heap_bytes=8<<20, std::size_t stack_bytes=256<<10, std::size_t thread_stack_bytes=512<<10);
+
+// SCHED_FIFO at priority (1-99), or back to the normal scheduler for 0
+bool set_realtime_priority(std::thread::native_handle_type thread, int priority);
+bool set_cpu_affinity(std::thread::native_handle_type thread, const std::vector<int>& cpus);
+// threads inherit their creator's affinity, so this also places threads started afterwards
+bool set_current_cpu_affinity(const std::vector<int>& cpus);
+
+int cpu_count();
+
+#endif
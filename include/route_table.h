@@ -0,0 +1,68 @@
+#ifndef ROUTE_TABLE_H__
+#define ROUTE_TABLE_H__
+
+#include "crow_integration.h"
+#include "json_writer.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+	Component endpoints, looked up by path in one sorted table instead of
+	registering each with crow. SimpleApp::mount puts one catch-all route in
+	front of each top level name in the table.
+
+	Handlers are plain functions bound at compile time for each component type,
+	so a request is a binary search and a direct call:
+
+		int tempStatus(TempSensor& t, const RouteRequest&, JSONWriter& w);
+		routes.add<tempStatus>("/brewery/hlt/temp/status", t);
+
+	An indexed route also answers path/<n>, with n in RouteRequest::index.
+*/
+struct RouteRequest {
+	const CrowRequest& req;
+	std::size_t index = 0; // only set for indexed routes
+};
+
+class RouteTable {
+public:
+	// writes the body and returns the status code
+	using Handler = int(*)(void* component, const RouteRequest&, JSONWriter&);
+	struct Route {
+		std::string path;
+		bool indexed;
+		Handler handler;
+		void* component;
+	};
+private:
+	std::vector<Route> routes;
+	bool sorted = true;
+
+	template<auto F, class C>
+	static int call(void* component, const RouteRequest& req, JSONWriter& w)
+	{
+		return F(*static_cast<C*>(component), req, w);
+	}
+	void insert(std::string path, bool indexed, Handler, void* component);
+public:
+	template<auto F, class C>
+	void add(std::string path, C& component)
+	{
+		insert(std::move(path), false, &call<F, C>, &component);
+	}
+	template<auto F, class C>
+	void addIndexed(std::string path, C& component)
+	{
+		insert(std::move(path), true, &call<F, C>, &component);
+	}
+
+	// sorts the table; done by SimpleApp::mount, and needed before find
+	void freeze();
+	// the route for path, nullptr if there isnt one; index is set for indexed routes
+	const Route* find(std::string_view path, std::size_t& index) const;
+	const std::vector<Route>& all() const {return routes;}
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef SCHEDULER_H__
+#define SCHEDULER_H__
+
+#include "clock.h"
+#include <chrono>
+#include <condition_variable>
+#include "histogram.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Runs periodic tasks from a small pool of worker threads.
+	Pending deadlines live in a min-heap keyed on absolute Clock time,
+	so a task's period does not drift with its own run time, and idle workers
+	sleep until the next deadline instead of polling.
+*/
+class Scheduler {
+public:
+	using clock = Clock;
+	using TaskId = std::size_t;
+	struct TaskStats {
+		std::string name;
+		std::chrono::microseconds period{0};
+		std::size_t runs = 0;
+		std::size_t overruns = 0; // deadlines that passed before the previous run finished
+		std::chrono::microseconds last_jitter{0}; // late start vs deadline
+		std::chrono::microseconds max_jitter{0};
+		std::chrono::microseconds total_jitter{0};
+		std::chrono::microseconds last_runtime{0};
+		std::chrono::microseconds max_runtime{0};
+		LatencyHistogram jitter_histogram;
+		LatencyHistogram runtime_histogram; // runs that reach the period overrun
+	};
+private:
+	struct Task {
+		std::function<void()> func;
+		clock::duration period;
+		TaskStats stats;
+	};
+	using Deadline = std::pair<clock::time_point, TaskId>;
+
+	std::mutex mut;
+	std::condition_variable cv;
+	std::map<TaskId, std::shared_ptr<Task>> tasks;
+	std::vector<Deadline> deadlines; // min-heap, may hold stale entries of cancelled tasks
+	std::set<TaskId> running;
+	TaskId next_id = 1;
+	bool finished = false;
+	std::vector<std::thread> workers;
+
+	void schedule(clock::time_point, TaskId);
+	void worker();
+public:
+	explicit Scheduler(unsigned num_workers=2);
+	Scheduler(const Scheduler&)=delete;
+	~Scheduler();
+
+	TaskId add(std::string name, std::function<void()> func, clock::duration period);
+	// once cancel returns the task is not running and never will again
+	void cancel(TaskId id);
+	std::vector<TaskStats> stats();
+	// for adjusting the workers' priority and affinity
+	std::vector<std::thread::native_handle_type> nativeHandles();
+
+	static Scheduler& global();
+	// for tasks that block on I/O, like sysfs reads and fsync; kept off the
+	// real-time core in realtime mode
+	static Scheduler& io();
+};
+
+class PeriodicTask {
+	Scheduler& sched;
+	Scheduler::TaskId id;
+public:
+	template<class F>
+	PeriodicTask(std::string name, F f, unsigned ms_period, Scheduler& sched=Scheduler::global()) :
+		sched(sched),
+		id(sched.add(name, f, std::chrono::milliseconds(ms_period)))
+	{}
+	PeriodicTask(const PeriodicTask&)=delete;
+	~PeriodicTask()
+	{
+		sched.cancel(id);
+	}
+};
+
+#endif
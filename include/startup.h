@@ -0,0 +1,67 @@
+#ifndef STARTUP_H__
+#define STARTUP_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Tracks how far startup has got. Slow hardware setup (waiting for 1-wire
+	devices to show up, registering interrupts) runs as background tasks, each
+	on its own thread, so the web server can come up without waiting for it;
+	the process is ready once the server is up and every task has finished.
+
+	Tasks and timed steps are grouped into named phases, whose times are logged
+	once ready. Times are real time, whatever the clock speed.
+*/
+class Startup {
+public:
+	using clock = std::chrono::steady_clock;
+	struct Phase {
+		std::string name;
+		clock::duration start; // since the process started
+		clock::duration took;
+		std::size_t pending; // background tasks still running
+	};
+private:
+	std::mutex mut;
+	std::condition_variable cv;
+	std::vector<Phase> phases;
+	std::vector<std::thread> threads;
+	std::function<void()> thread_start;
+	bool serving = false;
+	bool logged_ready = false;
+	bool stopping = false;
+	Phase& phase(const std::string& name, clock::time_point now);
+	void logReady();
+public:
+	Startup() = default;
+	Startup(const Startup&)=delete;
+	~Startup();
+
+	// brackets a step run on this thread as part of the named phase
+	void begin(const std::string& name);
+	void end(const std::string& name);
+	// runs f on its own thread as part of the named phase
+	void background(const std::string& name, std::function<void()> f);
+	// runs first on every background thread started afterwards, e.g. to move it off the RT core
+	void onThreadStart(std::function<void()> f);
+	// for background tasks waiting on hardware: calls attempt every period until it
+	// succeeds; false if it didnt within timeout, or startup was stopped
+	bool retry(clock::duration period, clock::duration timeout, const std::function<bool()>& attempt);
+	// the web server is about to take requests
+	void markServing();
+	bool ready();
+	std::vector<Phase> getPhases();
+	// cuts retries short and waits for the background tasks; call before what they set up goes away
+	void stop();
+
+	static Startup& global();
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TELEMETRY_LOG_H__
+#define TELEMETRY_LOG_H__
+
+#include "brewery_components.h"
+#include "heater_control.h"
+#include "scheduler.h"
+#include "temp_history.h"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+	Append-only log of temperature samples and setpoint/actuator changes, so they
+	survive a restart. Records are length prefixed and CRC checked, and go into
+	numbered segment files of bounded size; the oldest segments are deleted
+	once there are too many. Appends only queue the record; a background task
+	writes each batch with a single fdatasync to spare the SD card.
+
+	The existing segments are replayed on construction and the result kept until
+	the components ask for it. Samples older than a TempHistory reaches are
+	dropped during replay. Every segment starts with the latest value of each
+	key, so a setting that hasnt changed in a while isnt lost with the old
+	segments.
+*/
+class TelemetryLog {
+public:
+	enum RecordType : std::uint8_t {Sample=1, Value=2};
+private:
+	std::filesystem::path dir;
+	std::size_t segment_bytes;
+	std::size_t max_segments;
+
+	std::mutex pending_mut;
+	std::string pending;
+	std::map<std::string, double> current; // latest Value of each key, heads each segment
+
+	// only touched by flush
+	int fd = -1;
+	std::size_t segment_size = 0;
+	std::uint64_t next_segment = 0;
+
+	std::map<std::string, std::vector<TempSample>> restored_samples;
+	std::map<std::string, double> restored_values;
+
+	std::unique_ptr<PeriodicTask> flush_task; // started once replay is done
+
+	void replay();
+	void replaySegment(const std::filesystem::path&);
+	void openSegment();
+	void flush();
+public:
+	TelemetryLog(std::filesystem::path dir, std::size_t segment_bytes=4<<20, std::size_t max_segments=16, unsigned ms_flush=5000);
+	TelemetryLog(const TelemetryLog&)=delete;
+	~TelemetryLog();
+
+	void append(RecordType type, const std::string& key, std::size_t time, double value);
+	// key's value as it stands, kept for the next segment without logging a change
+	void keep(const std::string& key, double value);
+
+	// what replay found for key; each can only be taken once
+	std::vector<TempSample> takeRestoredSamples(const std::string& key);
+	bool takeRestoredValue(const std::string& key, double& value);
+};
+
+/* Attach Telemetry */
+// restores each component's logged state, then logs every change to it
+template<class...Comps>
+void attachTelemetry(ComponentTuple<Comps...>& ct, TelemetryLog& log, std::string keyPrefix)
+{
+	for_each_component(ct, [&](auto&& comp) {
+			attachTelemetry(std::forward<decltype(comp)>(comp), log, keyPrefix+"/"+ct.getName());
+		});
+}
+void attachTelemetry(TempSensor& t, TelemetryLog& log, std::string keyPrefix);
+// restores the tuned gains
+void attachTelemetry(HeaterController& h, TelemetryLog& log, std::string keyPrefix);
+template<class T>
+void attachTelemetry(ReadableValue<T>&, TelemetryLog&, std::string)
+{
+	// nothing we set, nothing to restore
+}
+template<class T>
+void attachTelemetry(WriteableValue<T>& w, TelemetryLog& log, std::string keyPrefix)
+{
+	auto key = keyPrefix+"/"+w.getName();
+	double value;
+	if( log.takeRestoredValue(key, value) )
+		w.set(static_cast<T>(value));
+	log.keep(key, w.get());
+	w.onChange([&log, key](T v) {
+			log.append(TelemetryLog::Value, key, time_in_seconds(), v);
+		});
+}
+
+#endif
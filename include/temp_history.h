@@ -0,0 +1,166 @@
+#ifndef TEMP_HISTORY_H__
+#define TEMP_HISTORY_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+	Fixed capacity ring; elements are addressed by a sequence number that keeps
+	counting up as old elements are overwritten. Storage is made of relaxed
+	atomic words so a reader racing the writer sees torn values rather than
+	undefined behaviour; TempHistory's sequence lock tells it to retry.
+*/
+template<class T>
+class Ring {
+	static_assert(std::is_trivially_copyable_v<T>);
+	static constexpr std::size_t Words = (sizeof(T) + sizeof(std::uint32_t) - 1) / sizeof(std::uint32_t);
+	struct Slot {
+		std::atomic<std::uint32_t> w[Words];
+	};
+	std::vector<Slot> buf;
+	std::atomic<std::size_t> count{0};
+public:
+	explicit Ring(std::size_t capacity) : buf(capacity ? capacity : 1) {}
+	void push(const T& v)
+	{
+		std::uint32_t tmp[Words] = {};
+		std::memcpy(tmp, &v, sizeof(T));
+		auto c = count.load(std::memory_order_relaxed);
+		auto& slot = buf[c % buf.size()];
+		for(std::size_t i = 0; i < Words; ++i)
+			slot.w[i].store(tmp[i], std::memory_order_relaxed);
+		count.store(c+1, std::memory_order_relaxed);
+	}
+	T at(std::size_t seq) const
+	{
+		std::uint32_t tmp[Words];
+		auto& slot = buf[seq % buf.size()];
+		for(std::size_t i = 0; i < Words; ++i)
+			tmp[i] = slot.w[i].load(std::memory_order_relaxed);
+		T ret;
+		std::memcpy(&ret, tmp, sizeof(T));
+		return ret;
+	}
+	std::size_t size() const {return count.load(std::memory_order_relaxed);} // one past the newest sequence number
+	std::size_t first() const {return size() > buf.size() ? size() - buf.size() : 0;}
+	T back() const {return at(size()-1);}
+	bool empty() const {return size() == 0;}
+	std::size_t capacity() const {return buf.size();}
+	std::size_t memoryBytes() const {return buf.size() * sizeof(Slot);}
+};
+
+struct TempSample {
+	std::size_t time; // seconds since the epoch
+	double temp;      // F
+};
+
+struct TempRollup {
+	std::size_t time; // start of the bucket
+	double min;
+	double avg;
+	double max;
+};
+
+/*
+	RRD style temperature history: raw samples for a recent window, then 10 second
+	and 1 minute min/avg/max rollups reaching further back. All storage is
+	allocated up front and temperatures are kept as hundredths of a degree F.
+
+	There is a single writer (the sensor's sampling task) and any number of
+	readers. append never blocks; readers copy what they need under a sequence
+	lock and retry if an append landed in the middle.
+*/
+class TempHistory {
+public:
+	enum Tier {TenSeconds=0, OneMinute=1, NumTiers};
+	static constexpr std::uint32_t TierSeconds[NumTiers] = {10, 60};
+	struct Series {
+		std::vector<std::uint32_t> time;
+		std::vector<std::int16_t> temp; // see quantize
+	};
+private:
+	struct RawEntry {
+		std::uint32_t time;
+		std::int16_t temp;
+	};
+	struct RollupEntry {
+		std::uint32_t time;
+		std::int16_t min;
+		std::int16_t avg;
+		std::int16_t max;
+	};
+	struct Accumulator {
+		bool active = false;
+		std::uint32_t bucket = 0;
+		std::int32_t sum = 0;
+		std::int32_t count = 0;
+		std::int16_t min = 0;
+		std::int16_t max = 0;
+	};
+	std::atomic<std::size_t> version{0}; // odd while an append is in progress
+	Ring<RawEntry> raw;
+	Ring<RollupEntry> tiers[NumTiers];
+	Accumulator accum[NumTiers]; // writer only
+	std::uint32_t last_time = 0; // writer only
+
+	template<class F>
+	auto read(F f) const
+	{
+		for(;;)
+		{
+			auto before = version.load(std::memory_order_acquire);
+			if( before & 1 )
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			auto ret = f();
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if( version.load(std::memory_order_relaxed) == before )
+				return ret;
+		}
+	}
+	static TempSample decode(const RawEntry& e) {return {e.time, dequantize(e.temp)};}
+	static TempRollup decode(const RollupEntry& e) {return {e.time, dequantize(e.min), dequantize(e.avg), dequantize(e.max)};}
+	template<class Out, class Entry>
+	std::size_t copyRange(const Ring<Entry>& ring, std::size_t from, std::size_t max, std::vector<Out>& out) const;
+	template<class Entry, class Temp>
+	static void appendRange(const Ring<Entry>& ring, std::uint32_t from, std::uint64_t before, Temp temp, Series& out);
+public:
+	// defaults hold one hour of 2 second samples, 6 hours of 10s rollups and a week of 1 minute rollups
+	static constexpr std::size_t DefaultRaw = 1800, DefaultTenSeconds = 2160, DefaultMinutes = 10080;
+	// how far back the default history reaches; anything older is dropped as it goes in
+	static constexpr std::size_t DefaultSpanSeconds = DefaultMinutes * TierSeconds[OneMinute];
+	explicit TempHistory(std::size_t raw_capacity=DefaultRaw, std::size_t ten_sec_capacity=DefaultTenSeconds, std::size_t minute_capacity=DefaultMinutes);
+	TempHistory(const TempHistory&)=delete;
+
+	// times never go backwards; a sample older than the last one is recorded at the last one's time
+	void append(std::size_t time, double temp);
+
+	// sequence number the next sample will get
+	std::size_t size() const {return raw.size();}
+	bool latest(TempSample& out) const;
+	// raw samples are addressed by sequence number; copies up to max of them starting
+	// at from (or the oldest one still held, if that is later) and returns the first
+	// sequence number copied
+	std::size_t samples(std::size_t from, std::size_t max, std::vector<TempSample>& out) const;
+	// same for completed rollup buckets
+	std::size_t rollups(Tier t, std::size_t from, std::size_t max, std::vector<TempRollup>& out) const;
+
+	// quantized points between from and to (inclusive, in seconds), oldest first, taken
+	// from the finest tier that still covers each stretch of time; rollups contribute
+	// their average. returns the sequence number the next raw sample will get
+	std::size_t range(std::size_t from, std::size_t to, Series& out) const;
+
+	std::size_t memoryBytes() const;
+
+	static std::int16_t quantize(double temp);
+	static double dequantize(std::int16_t q);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef TEMP_SENSOR_BUS_H__
+#define TEMP_SENSOR_BUS_H__
+
+#include "scheduler.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+
+class Counter;
+class Histogram;
+
+/*
+	Owns sampling of every 1-wire temperature sensor. Each period it has all of
+	them convert at once, then reads them back in one pass, so the time between
+	samples does not grow with the number of sensors. Kernels without bulk
+	conversion fall back to reading each sensor through wiringPi in turn.
+*/
+class TempSensorBus {
+public:
+	using Callback = std::function<void(double)>; // temp in F
+	using SubscriberId = std::size_t;
+private:
+	// looked up once per pin, so reads dont go through the registry
+	struct PinMetrics {
+		Counter* failures;
+		Counter* fallbacks;
+		Histogram* read_duration;
+	};
+	std::mutex mut;
+	std::map<SubscriberId, std::pair<int, Callback>> subscribers;
+	std::map<int, PinMetrics> pin_metrics;
+	Histogram& convert_duration;
+	SubscriberId next_id = 1;
+	PeriodicTask update_task; // last, so it starts once everything else is ready
+	void update();
+public:
+	// a conversion blocks for most of a second, so it runs with the other I/O
+	explicit TempSensorBus(unsigned ms_period=2000, Scheduler& sched=Scheduler::io());
+	TempSensorBus(const TempSensorBus&)=delete;
+
+	// callback gets every new reading of the sensor mapped to pin
+	SubscriberId subscribe(int pin, Callback callback);
+	// once this returns the callback will not be called again
+	void unsubscribe(SubscriberId id);
+
+	static TempSensorBus& global();
+
+	class Subscription {
+		TempSensorBus& bus;
+		SubscriberId id;
+	public:
+		Subscription(int pin, Callback callback, TempSensorBus& bus=TempSensorBus::global()) : bus(bus), id(bus.subscribe(pin, callback)) {}
+		Subscription(const Subscription&)=delete;
+		~Subscription() {bus.unsubscribe(id);}
+	};
+};
+
+#endif
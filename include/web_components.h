@@ -3,11 +3,16 @@
 
 #include "crow_integration.h"
 #include "brewery_components.h"
+#include "heater_control.h"
+#include "json_writer.h"
+#include "mash_schedule.h"
+#include "route_table.h"
 #include <string>
 #include <sstream>
 
 std::string generateSelector(std::string name, std::vector<std::string> parent);
 std::string generateEndpoint(std::string name, std::vector<std::string> parent);
+void generateHistory(TempSensor&, std::size_t from, std::size_t to, JSONWriter&);
 
 /* Generate Layout */
 template<class...Comps>
@@ -29,28 +34,81 @@ std::string generateLayout(ReadableValue<T>& r);
 template<class T>
 std::string generateLayout(TargetValue<T>& t);
 
+/* Generate Status */
+template<class...Comps>
+void generateStatus(ComponentTuple<Comps...>& ct, JSONWriter& w)
+{
+	w.beginObject();
+	for_each_component(ct, [&](auto&& comp) {
+			w.key(comp.getName());
+			generateStatus(std::forward<decltype(comp)>(comp), w);
+		});
+	w.endObject();
+}
+void generateStatus(TempSensor&, JSONWriter&);
+void generateStatus(Button& b, JSONWriter&);
+void generateStatus(FlowSensor& f, JSONWriter&);
+void generateStatus(HeaterController& h, JSONWriter&);
+void generateStatus(MashSchedule& m, JSONWriter&);
+template<class T>
+void generateStatus(ReadableValue<T>& r, JSONWriter&);
+template<class T>
+void generateStatus(TargetValue<T>& t, JSONWriter&);
+
 /* Register Endpoints */
+// adds each component's routes to the table; mount it on the app once everything is in
+namespace Details {
+template<class C>
+int statusRoute(C& c, const RouteRequest&, JSONWriter& w)
+{
+	generateStatus(c, w);
+	return 200;
+}
+}
 template<class...Comps>
-void registerEndpoints(ComponentTuple<Comps...>& ct, SimpleApp& app, std::string endpointPrefix)
+void registerEndpoints(ComponentTuple<Comps...>& ct, RouteTable& routes, std::string endpointPrefix)
 {
 	for_each_component(ct, [&](auto&& comp) {
-			registerEndpoints(std::forward<decltype(comp)>(comp), app, endpointPrefix+"/"+ct.getName());
+			registerEndpoints(std::forward<decltype(comp)>(comp), routes, endpointPrefix+"/"+ct.getName());
 		});
-	// could also register the tuple as an endpoint to get all status at once
+	// the whole subtree's status at once, so clients can update every widget with one request
+	routes.add<Details::statusRoute<ComponentTuple<Comps...>>>(endpointPrefix+"/"+ct.getName()+"/status", ct);
 }
-void registerEndpoints(TempSensor&, SimpleApp& app, std::string endpointPrefix);
-void registerEndpoints(Button& b, SimpleApp& app, std::string endpointPrefix);
+void registerEndpoints(TempSensor&, RouteTable& routes, std::string endpointPrefix);
+void registerEndpoints(Button& b, RouteTable& routes, std::string endpointPrefix);
+void registerEndpoints(FlowSensor& f, RouteTable& routes, std::string endpointPrefix);
+void registerEndpoints(HeaterController& h, RouteTable& routes, std::string endpointPrefix);
+void registerEndpoints(MashSchedule& m, RouteTable& routes, std::string endpointPrefix);
 template<class T>
-void registerEndpoints(ReadableValue<T>& r, SimpleApp& app, std::string endpointPrefix);
+void registerEndpoints(ReadableValue<T>& r, RouteTable& routes, std::string endpointPrefix);
 template<class T>
-void registerEndpoints(TargetValue<T>& t, SimpleApp& app, std::string endpointPrefix);
+void registerEndpoints(TargetValue<T>& t, RouteTable& routes, std::string endpointPrefix);
+
+/* Push Status */
+// meant to run every tick; SimpleApp::push drops it when nothing changed since the last one
+template<class...Comps>
+void pushStatus(ComponentTuple<Comps...>& ct, SimpleApp& app, std::string endpointPrefix)
+{
+	thread_local std::string buffer;
+	buffer.clear();
+	auto endpoint = endpointPrefix+"/"+ct.getName();
+	JSONWriter w(buffer);
+	w.beginObject().field("endpoint", endpoint).key("status");
+	generateStatus(ct, w);
+	w.endObject();
+	app.push(endpoint, buffer);
+}
+void pushStatus(MashSchedule& m, SimpleApp& app, std::string endpointPrefix);
 
 /* Generate Update JS */
 template<class...Comps>
 std::string generateUpdateJS(ComponentTuple<Comps...>& ct, std::vector<std::string> parent)
 {
-	parent.push_back(ct.getName());
 	std::string ret;
+	// the outermost tuple subscribes to its pushed status and hands each widget its piece
+	if( parent.empty() )
+		ret += "subscribeStatus('" + generateEndpoint(ct.getName(), parent) + "');\n";
+	parent.push_back(ct.getName());
 	for_each_component(ct, [&](auto&& comp) {
 			ret += generateUpdateJS(std::forward<decltype(comp)>(comp), parent);
 		});
@@ -58,6 +116,7 @@ std::string generateUpdateJS(ComponentTuple<Comps...>& ct, std::vector<std::stri
 }
 std::string generateUpdateJS(TempSensor&, std::vector<std::string> parent);
 std::string generateUpdateJS(Button& b, std::vector<std::string> parent);
+std::string generateUpdateJS(FlowSensor& f, std::vector<std::string> parent);
 template<class T>
 std::string generateUpdateJS(ReadableValue<T>& r, std::vector<std::string> parent);
 template<class T>
@@ -1,7 +1,10 @@
 #include "brewery_components.h"
+#include <algorithm>
 #include <chrono>
 #include <wiringPi.h>
 #include "i2c.h"
+#include "startup.h"
+#include <iostream>
 
 void DigitalPin::setup() const {
 	pinMode(pin, mode);
@@ -17,55 +20,100 @@ void DigitalPin::off() const {
 
 std::size_t time_in_seconds()
 {
-	auto dur = std::chrono::system_clock::now().time_since_epoch();
-	return std::chrono::duration_cast<std::chrono::seconds>(dur).count();
+	return Clock::epochSeconds();
 }
 
-void TempSensor::update() {
-	auto temp = (analogRead(pin_num) / 10.0) * 1.8 + 32; // return in F
-	auto cur_time = time_in_seconds() - start_time;
+void TempSensor::update(double tempF) {
 	std::lock_guard<std::mutex> g{mut};
-	tempHistory.push_back({cur_time, temp});
+	TempSample sample{time_in_seconds(), tempF};
+	tempHistory.append(sample.time, sample.temp);
+	for(auto&& f : sampleListeners)
+		f(sample);
+}
+void TempSensor::restore(const std::vector<TempSample>& samples) {
+	std::lock_guard<std::mutex> g{mut};
+	if( tempHistory.size() != 0 )
+		return;
+	for(auto&& s : samples)
+		tempHistory.append(s.time, s.temp);
+}
+void TempSensor::onSample(std::function<void(const TempSample&)> f) {
+	std::lock_guard<std::mutex> g{mut};
+	sampleListeners.push_back(std::move(f));
 }
 TempSensor::TempSensor(std::string name, int pin_num, const char* deviceId) :
 	Named(name),
 	pin_num{pin_num},
-	start_time(time_in_seconds()),
-	update_thread([&](){this->update();},2000)
+	subscription(pin_num, [this](double tempF){this->update(tempF);})
 {
-	setI2CDeviceForPin(pin_num, deviceId);
+	// at boot the bus can take a while to list its devices; wait for ours without holding anything up
+	Startup::global().background("temp_sensors", [name, pin_num, id=std::string(deviceId)]{
+			using namespace std::chrono_literals;
+			// a device picked on the config tab in the meantime wins
+			if( not Startup::global().retry(1s, 120s, [&]{return isI2CDeviceMapped(pin_num) or setI2CDeviceForPin(pin_num, id);}) )
+				std::cerr << "startup: no 1-wire device " << id << " for " << name << std::endl;
+		});
 }
 TempSensor::TempSensor(const TempSensor& rhs) :
 	Named(rhs.getName()),
 	pin_num{rhs.pin_num},
-	start_time{rhs.start_time},
-	update_thread([&](){this->update();},2000)
+	subscription(pin_num, [this](double tempF){this->update(tempF);})
 {}
 double TempSensor::getTempF() {
-	if( tempHistory.size() )
-	{
-		std::lock_guard<std::mutex> g{mut};
-		return tempHistory.back().second;
-	}
-	else
-		return 0.0;
+	TempSample latest;
+	if( tempHistory.latest(latest) )
+		return latest.temp;
+	return 0.0;
 }
 
 void CountEdges::update(void* v) {
 	CountEdges* me = static_cast<CountEdges*>(v);
-	++(me->edges);
+	auto now = clock::now().time_since_epoch().count();
+	auto n = me->edges.load(std::memory_order_relaxed);
+	me->edge_times[n % HistorySize].store(now, std::memory_order_relaxed);
+	me->edges.store(n+1, std::memory_order_release);
+}
+std::size_t CountEdges::recentEdgeTimes(clock::time_point* out, std::size_t max) const {
+	auto n = getEdges();
+	max = std::min<std::uint64_t>({max, n, HistorySize});
+	for(std::size_t i = 0; i < max; ++i)
+		out[i] = clock::time_point(clock::duration(edge_times[(n-1-i) % HistorySize].load(std::memory_order_relaxed)));
+	// anything the ISR may have lapped while we were reading is dropped
+	std::atomic_thread_fence(std::memory_order_acquire);
+	auto lapped = edges.load(std::memory_order_relaxed) - n;
+	return lapped >= HistorySize ? 0 : std::min<std::uint64_t>(max, HistorySize - 1 - lapped);
 }
 CountEdges::CountEdges(int PinNum, int EdgeType) {
-	wiringPiISR_data(PinNum, EdgeType, &update, this);
+	// wiringPi sets up each interrupt by running the gpio utility, so do them all at once
+	Startup::global().background("interrupts", [this, PinNum, EdgeType]{
+			wiringPiISR_data(PinNum, EdgeType, &update, this);
+		});
 }
 
-int FlowSensor::edgeCount() {
-	return sensor.getEdges() - initialEdgeCount;
+double CountEdges::edgesPerSecond(clock::duration window) const {
+	constexpr std::size_t MaxEdges = 16;
+	clock::time_point times[MaxEdges];
+	auto count = recentEdgeTimes(times, MaxEdges);
+	auto now = clock::now();
+	while( count > 0 and now - times[count-1] > window )
+		--count;
+	if( count < 2 )
+		return 0.0;
+	using seconds = std::chrono::duration<double>;
+	auto period = seconds(times[0] - times[count-1]).count() / (count-1);
+	// once the gap since the last edge outgrows the usual period the flow is slowing,
+	// and that gap bounds the rate
+	auto since_last = seconds(now - times[0]).count();
+	return 1.0 / std::max(period, since_last);
+}
+
+std::uint64_t FlowSensor::edgeCount() {
+	return sensor.edgesSince(initialEdgeCount);
 }
 void FlowSensor::resetFlowCount() {
 	initialEdgeCount = sensor.getEdges();
 }
-FlowSensor::FlowSensor(std::string n, int PinNum, int EdgesPerLiter) : ReadableValue<double>{n}, sensor{PinNum, INT_EDGE_RISING}, EdgesPerLiter{EdgesPerLiter} {
+FlowSensor::FlowSensor(std::string n, int PinNum, int EdgesPerLiter) : ReadableValue<double>{n}, sensor{PinNum, INT_EDGE_RISING}, EdgesPerLiter{EdgesPerLiter}, rate{"rate", *this} {
 	resetFlowCount();
 	//		CROW_LOG_INFO << "FlowSensor<" << PinNum << ", " << EdgesPerLiter << ">:";
 	//		CROW_LOG_INFO << "initialEdgeCount = " << initialEdgeCount;
@@ -77,6 +125,15 @@ double FlowSensor::getFlowInLiters() {
 double FlowSensor::getFlowInGallons() {
 	return getFlowInLiters() / LitersPerGallon;
 }
+double FlowSensor::getRateInLitersPerMinute() {
+	return sensor.edgesPerSecond(RateWindow) * 60 / EdgesPerLiter;
+}
+double FlowSensor::getRateInGallonsPerMinute() {
+	return getRateInLitersPerMinute() / LitersPerGallon;
+}
 double FlowSensor::get() {
 	return getFlowInGallons();
 }
+double FlowRate::get() {
+	return sensor.getRateInGallonsPerMinute();
+}
@@ -1,91 +1,300 @@
 #include <string>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <filesystem>
+#include <mutex>
 #include "crow_integration.h"
 #include "brewery_components.h"
 #include "board_layout.h"
 #include "web_components.h"
+#include "route_table.h"
 #include "i2c.h"
+#include "scheduler.h"
+#include "http_cache.h"
+#include "telemetry_log.h"
+#include "control_loop.h"
+#include "heater_control.h"
+#include "mash_schedule.h"
+#include "realtime.h"
+#include "metrics.h"
+#include "clock.h"
+#include "startup.h"
+#ifdef MOCK
+#include "plant_sim.h"
+#endif
 
 /*
 	build with:
-		g++ brewery_test.cpp -I ../crow/include/ --std=c++17 -pthread -lwiringPi -lboost_system -latomic -Wno-psabi -g
+		g++ brewery_test.cpp -I ../crow/include/ --std=c++17 -pthread -lwiringPi -lboost_system -latomic -lz -Wno-psabi -g
 	need to have loaded the 1-wire bus via:
 		sudo dtoverlay w1-gpio
 		then devices will be at /sys/bus/w1/devices/
 */
 
-/* relay output */
-constexpr auto HLT_REFLOW_VALVE_PIN = RELAY1_PIN;
-constexpr auto PUMP_ASSEMBLY_INPUT_VALVE_PIN = RELAY2_PIN;
-constexpr auto PUMP_ASSEMBLY_OUTPUT_VALVE_PIN = RELAY3_PIN;
-/* I2C connected */
-constexpr auto HLT_TEMP_PIN = 65; /* this doesnt map to anything physical, just needs to be unique */
-constexpr auto HLT_TEMP_ID = "00000554cba2";
-constexpr auto PUMP_ASSEMBLY_TEMP_PIN = 66; /* this doesnt map to anything physical, just needs to be unique */
-constexpr auto PUMP_ASSEMBLY_TEMP_ID = "000005582ff0";
-/* SSR output */
-constexpr auto HLT_PUMP_PIN = SSR1_PIN;
-constexpr auto PUMP_ASSEMBLY_PUMP_PIN = SSR2_PIN;
-/* Digital in */
-constexpr auto HLT_INPUT_FLOW_PIN = DIG1_PIN;
-constexpr auto HLT_OUTPUT_FLOW_PIN = DIG2_PIN;
-constexpr auto MT_OUTPUT_FLOW_PIN = DIG3_PIN;
-//MT_LIQUID_MAX_PIN
-
-/* Digital out */
-constexpr auto HLT_HEATER_PIN = DIG4_PIN;
-constexpr auto BREW_KETTLE_HEATER_PIN = DIG5_PIN;
+/*
+	Pins and 1-wire probe ids of one rig. The defaults are the board this was
+	built for; every further rig on the same controller needs its own, loaded
+	from a file of "key value" lines by --rig. The probes' pins dont map to
+	anything physical and are handed out per rig so they never collide.
+*/
+struct RigLayout {
+	std::string name = "brewery";
+	/* relay output */
+	int hlt_reflow_valve = RELAY1_PIN;
+	int pump_assembly_input_valve = RELAY2_PIN;
+	int pump_assembly_output_valve = RELAY3_PIN;
+	/* I2C connected */
+	int hlt_temp = 65;
+	std::string hlt_temp_id = "00000554cba2";
+	int pump_assembly_temp = 66;
+	std::string pump_assembly_temp_id = "000005582ff0";
+	/* SSR output */
+	int hlt_pump = SSR1_PIN;
+	int pump_assembly_pump = SSR2_PIN;
+	/* Digital in */
+	int hlt_input_flow = DIG1_PIN;
+	int hlt_output_flow = DIG2_PIN;
+	int mt_output_flow = DIG3_PIN;
+	//MT_LIQUID_MAX_PIN
+	/* Digital out */
+	int hlt_heater = DIG4_PIN;
+	int brew_kettle_heater = DIG5_PIN;
+
+	void setProbePins(std::size_t rig_index)
+	{
+		hlt_temp = 65 + 2*rig_index;
+		pump_assembly_temp = 66 + 2*rig_index;
+	}
+
+	// every pin the rig drives or reads, by the name layout files use
+	static const std::map<std::string, int RigLayout::*>& pins()
+	{
+		static const std::map<std::string, int RigLayout::*> p = {
+			{"hlt_reflow_valve", &RigLayout::hlt_reflow_valve},
+			{"pump_assembly_input_valve", &RigLayout::pump_assembly_input_valve},
+			{"pump_assembly_output_valve", &RigLayout::pump_assembly_output_valve},
+			{"hlt_pump", &RigLayout::hlt_pump},
+			{"pump_assembly_pump", &RigLayout::pump_assembly_pump},
+			{"hlt_input_flow", &RigLayout::hlt_input_flow},
+			{"hlt_output_flow", &RigLayout::hlt_output_flow},
+			{"mt_output_flow", &RigLayout::mt_output_flow},
+			{"hlt_heater", &RigLayout::hlt_heater},
+			{"brew_kettle_heater", &RigLayout::brew_kettle_heater},
+		};
+		return p;
+	}
+
+	struct Probe {
+		std::string name; // as the config tab and the sensor map know it
+		int pin;
+		std::string& device_id;
+	};
+	std::vector<Probe> probes()
+	{
+		return {{"hlt_temp", hlt_temp, hlt_temp_id}, {"pump_temp", pump_assembly_temp, pump_assembly_temp_id}};
+	}
+};
+
+bool loadRigLayout(const std::string& path, RigLayout& layout)
+{
+	auto& pins = RigLayout::pins();
+	static const std::map<std::string, std::string RigLayout::*> strings = {
+		{"name", &RigLayout::name},
+		{"hlt_temp_id", &RigLayout::hlt_temp_id},
+		{"pump_assembly_temp_id", &RigLayout::pump_assembly_temp_id},
+	};
+	std::ifstream in(path);
+	if( not in )
+	{
+		std::cerr << "cant open rig layout " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	for(int line_num = 1; std::getline(in, line); ++line_num)
+	{
+		std::stringstream ss(line);
+		std::string key, value, extra;
+		if( not (ss >> key) or key[0] == '#' )
+			continue;
+		// one value per key, and a pin has to be all number
+		bool ok = ss >> value and not (ss >> extra);
+		if( ok and pins.count(key) )
+		{
+			std::stringstream num(value);
+			int pin;
+			char junk;
+			ok = num >> pin and not (num >> junk);
+			if( ok )
+				layout.*pins.at(key) = pin;
+		}
+		else if( ok and strings.count(key) )
+			layout.*strings.at(key) = value;
+		else
+			ok = false;
+		if( not ok )
+		{
+			std::cerr << path << ":" << line_num << ": bad line \"" << line << "\"" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	The 1-wire device picked for each probe on the config tab, kept in a file of
+	"<rig>/<probe> <device>" lines so the choice survives a restart.
+*/
+class SensorMap {
+	std::string path;
+	std::mutex mut;
+	std::map<std::string, std::string> devices;
+	void save()
+	{
+		auto tmp = path + ".tmp";
+		{
+			std::ofstream out(tmp);
+			for(auto&& d : devices)
+				out << d.first << " " << d.second << "\n";
+			if( not (out << std::flush) )
+			{
+				std::cerr << "cant write sensor map " << tmp << std::endl;
+				return;
+			}
+		}
+		// so a crash mid write cant lose the old one
+		std::error_code ec;
+		std::filesystem::rename(tmp, path, ec);
+		if( ec )
+			std::cerr << "cant replace sensor map " << path << ": " << ec.message() << std::endl;
+	}
+public:
+	explicit SensorMap(std::string p) : path(std::move(p))
+	{
+		std::ifstream in(path);
+		std::string probe, device;
+		while( in >> probe >> device )
+			devices[probe] = device;
+	}
+	// saved choices replace the layout's defaults
+	void apply(RigLayout& l)
+	{
+		std::lock_guard<std::mutex> g{mut};
+		for(auto&& probe : l.probes())
+		{
+			auto it = devices.find(l.name + "/" + probe.name);
+			if( it != devices.end() )
+				probe.device_id = it->second;
+		}
+	}
+	void set(const std::string& rig, const std::string& probe, const std::string& device)
+	{
+		std::lock_guard<std::mutex> g{mut};
+		auto& d = devices[rig + "/" + probe];
+		if( d == device )
+			return;
+		d = device;
+		save();
+	}
+};
+
+#ifdef MOCK
+// simulated rigs beyond the first get pins nothing else uses
+RigLayout simulatedRigLayout(std::size_t index)
+{
+	RigLayout layout;
+	if( index == 0 )
+		return layout;
+	layout.name = "brewery" + std::to_string(index+1);
+	layout.hlt_temp_id += "_" + std::to_string(index);
+	layout.pump_assembly_temp_id += "_" + std::to_string(index);
+	for(auto&& pin : RigLayout::pins())
+		layout.*pin.second += 1000*index;
+	return layout;
+}
+
+// off the Pi the pins above drive a simulated brewery
+void setupSimulation(const RigLayout& l)
+{
+	auto& sim = PlantSim::global();
+	auto hlt = sim.addVessel({l.name + "/hlt", l.hlt_heater});
+	auto bk = sim.addVessel({l.name + "/bk", l.brew_kettle_heater, 5500, 30});
+	sim.addProbe({l.hlt_temp, hlt});
+	// the pump assembly's probe sits on the kettle outlet
+	sim.addProbe({l.pump_assembly_temp, bk});
+	sim.addFlow({l.hlt_output_flow, {l.hlt_pump}});
+	sim.addFlow({l.mt_output_flow, {l.pump_assembly_input_valve, l.pump_assembly_pump, l.pump_assembly_output_valve}});
+}
+#endif
 
 struct HotLiquorTank : public ComponentTuple<FlowSensor, Heater, Valve, Pump, TempSensor, FlowSensor> {
-	HotLiquorTank(std::string name) :
+	HeaterController heater_control{"heater_control", this->get<1>(), this->get<4>()};
+	MashSchedule mash_schedule{"mash_schedule", this->get<1>(), this->get<4>().getHistory()};
+	std::unique_ptr<PeriodicTask> mash_tick;
+	HotLiquorTank(std::string name, const RigLayout& l) :
 		ComponentTuple(name,
-				std::make_tuple("input_flow", HLT_INPUT_FLOW_PIN),
-				std::make_tuple("heater",50,200,HLT_HEATER_PIN),
-				std::make_tuple("reflow_valve",HLT_REFLOW_VALVE_PIN),
-				std::make_tuple("pump",HLT_PUMP_PIN),
-				std::make_tuple("reflow_temp", HLT_TEMP_PIN, HLT_TEMP_ID),
-				std::make_tuple("output_flow", HLT_OUTPUT_FLOW_PIN)
+				std::make_tuple("input_flow", l.hlt_input_flow),
+				std::make_tuple("heater",50,200,l.hlt_heater),
+				std::make_tuple("reflow_valve",l.hlt_reflow_valve),
+				std::make_tuple("pump",l.hlt_pump),
+				std::make_tuple("reflow_temp", l.hlt_temp, l.hlt_temp_id.c_str()),
+				std::make_tuple("output_flow", l.hlt_output_flow)
 			) {}
-	void update()
+	void connect(ControlLoop& loop, std::string prefix)
 	{
-		auto& heater = this->get<1>();
-		auto& temp = this->get<4>();
-		if( temp.getTempF() < heater.get() )
-			heater.on();
-		else
-			heater.off();
+		// added first so a new step's target reaches the heater controller in the same pass
+		auto mash = loop.add(prefix+"/"+getName()+"/mash_schedule", [this]{mash_schedule.update();});
+		loop.dependsOn(mash, this->get<4>());
+		mash_schedule.onCommand([&loop, mash]{loop.markDirty(mash);});
+		// holds end on time even if the sensor goes quiet
+		mash_tick = std::make_unique<PeriodicTask>(prefix+"/"+getName()+"/mash_tick", [&loop, mash]{loop.markDirty(mash);}, 1000);
+		auto id = loop.add(prefix+"/"+getName(), [this]{heater_control.update();});
+		loop.dependsOn(id, this->get<1>());
+		loop.dependsOn(id, this->get<4>());
 	}
 };
 
 struct MashTun : public ComponentTuple<LevelSensor, FlowSensor> {
-	MashTun(std::string name) :
+	MashTun(std::string name, const RigLayout& l) :
 		ComponentTuple(name,
 				"liquid_max",
-				std::make_tuple("output_flow", MT_OUTPUT_FLOW_PIN)
+				std::make_tuple("output_flow", l.mt_output_flow)
 			) {}
 };
 
 struct BrewKettle : public ComponentTuple<Button> {
-	BrewKettle(std::string name) : ComponentTuple(name, std::make_tuple("heater",BREW_KETTLE_HEATER_PIN)) {}
+	BrewKettle(std::string name, const RigLayout& l) : ComponentTuple(name, std::make_tuple("heater",l.brew_kettle_heater)) {}
 };
 
 struct PumpAssembly : public ComponentTuple<Valve, Pump, TempSensor, Valve> {
-	PumpAssembly(std::string name) :
+	PumpAssembly(std::string name, const RigLayout& l) :
 		ComponentTuple(name,
-				std::make_tuple("input_valve",PUMP_ASSEMBLY_INPUT_VALVE_PIN),
-				std::make_tuple("pump",PUMP_ASSEMBLY_PUMP_PIN),
-				std::make_tuple("temp", PUMP_ASSEMBLY_TEMP_PIN, PUMP_ASSEMBLY_TEMP_ID),
-				std::make_tuple("output_valve",PUMP_ASSEMBLY_OUTPUT_VALVE_PIN)
+				std::make_tuple("input_valve",l.pump_assembly_input_valve),
+				std::make_tuple("pump",l.pump_assembly_pump),
+				std::make_tuple("temp", l.pump_assembly_temp, l.pump_assembly_temp_id.c_str()),
+				std::make_tuple("output_valve",l.pump_assembly_output_valve)
 			) {}
 };
 
 struct Brewery : public ComponentTuple<HotLiquorTank, MashTun, BrewKettle, PumpAssembly> {
-	Brewery(std::string name) : ComponentTuple(name, "hlt", "mt", "bk", "pump_assembly") {}
-	void update()
+	Brewery(const RigLayout& l) :
+		ComponentTuple(l.name,
+				std::forward_as_tuple("hlt", l),
+				std::forward_as_tuple("mt", l),
+				std::forward_as_tuple("bk", l),
+				std::forward_as_tuple("pump_assembly", l)
+			) {}
+	// each controller reruns whenever one of its inputs changes
+	void connect(ControlLoop& loop)
 	{
 		auto& HLT = this->get<0>();
-		HLT.update();
+		HLT.connect(loop, getName());
 	}
+	HeaterController& heaterControl() {return this->get<0>().heater_control;}
+	MashSchedule& mashSchedule() {return this->get<0>().mash_schedule;}
 };
 
 std::string generateLayout(Brewery& ct)
@@ -97,44 +306,288 @@ std::string generateLayout(Brewery& ct)
 	return ret;
 }
 
+/*
+	One brewery and the control thread that runs its controllers. Rigs share the
+	web server, the schedulers and the sensor bus; each has its own control
+	thread so rigs dont wait on each other.
+*/
+struct Rig {
+	RigLayout layout;
+	ControlLoop control; // outlives the brewery, whose components trigger it
+	Brewery brewery;
+	explicit Rig(RigLayout l) : layout(std::move(l)), brewery(layout) {}
+	std::string prefix() const {return "/" + layout.name;}
+};
+
+// the whole of s as a whole number from min to max; out is left alone otherwise
+bool parseOption(const char* s, long min, long max, long& out)
+{
+	std::stringstream ss(s);
+	long v;
+	char junk;
+	if( not (ss >> v) or ss >> junk or v < min or v > max )
+		return false;
+	out = v;
+	return true;
+}
+
 //instead of including the entire wiringpi header
 extern "C" int wiringPiSetup();
 
 int main(int argc, char* argv[])
 {
+	// hardware that is slow to come up is set up in the background; the phases are logged as they finish
+	auto& startup = Startup::global();
+	startup.begin("wiringpi");
 	wiringPiSetup();
-	Brewery brewery("brewery");
-	RepeatThread update_thread([&](){
-		brewery.update();
-	}, 100);
+	startup.end("wiringpi");
 	SimpleApp app;
-	crow_mustache_set_base("/home/admin/Brewing");
+	std::string template_dir = "/home/admin/Brewing";
+	std::string telemetry_dir;
+	std::string sensor_map_path;
+	bool realtime = false;
+	unsigned port = 40080;
+	std::vector<RigLayout> layouts;
+#ifdef MOCK
+	double sim_speed = 1;
+	std::size_t sim_rigs = 1;
+#endif
 
 	for(int arg = 1; arg < argc; ++arg )
 	{
 		std::string argstr = argv[arg];
 		if( argstr == "--debug" or argstr == "-debug" )
 			app.loglevel(SimpleApp::Debug);
+		if( argstr == "--realtime" )
+			realtime = true;
+#ifdef MOCK
+		if( argstr == "--sim_speed" )
+		{
+			std::stringstream ss(arg+1 < argc ? argv[++arg] : "");
+			char junk;
+			if( not (ss >> sim_speed) or ss >> junk or not std::isfinite(sim_speed) or sim_speed <= 0 )
+			{
+				std::cerr << "need a speed above 0 after --sim_speed option!" << std::endl;
+				return -1;
+			}
+		}
+		if( argstr == "--sim_rigs" )
+		{
+			long rigs;
+			if( not parseOption(arg+1 < argc ? argv[++arg] : "", 1, 64, rigs) )
+			{
+				std::cerr << "need a count from 1 to 64 after --sim_rigs option!" << std::endl;
+				return -1;
+			}
+			sim_rigs = rigs;
+		}
+#endif
+		if( argstr == "--rig" )
+		{
+			RigLayout layout;
+			if( arg+1 >= argc )
+			{
+				std::cerr << "need a layout file after --rig option!" << std::endl;
+				return -1;
+			}
+			if( not loadRigLayout(argv[++arg], layout) )
+				return -1;
+			layouts.push_back(layout);
+		}
+		if( argstr == "--port" )
+		{
+			long p;
+			if( not parseOption(arg+1 < argc ? argv[++arg] : "", 1, 65535, p) )
+			{
+				std::cerr << "need a port number from 1 to 65535 after --port option!" << std::endl;
+				return -1;
+			}
+			port = p;
+		}
 		if( argstr == "--template_dir" )
 		{
 			if( arg+1 < argc )
-				crow_mustache_set_base(argv[++arg]);
+				template_dir = argv[++arg];
 			else
 			{
 				std::cerr << "need directory after --template_dir option!" << std::endl;
 				return -1;
 			}
 		}
+		if( argstr == "--sensor_map" )
+		{
+			if( arg+1 < argc )
+				sensor_map_path = argv[++arg];
+			else
+			{
+				std::cerr << "need a file after --sensor_map option!" << std::endl;
+				return -1;
+			}
+		}
+		if( argstr == "--telemetry_dir" )
+		{
+			if( arg+1 < argc )
+				telemetry_dir = argv[++arg];
+			else
+			{
+				std::cerr << "need directory after --telemetry_dir option!" << std::endl;
+				return -1;
+			}
+		}
+	}
+	if( telemetry_dir.empty() )
+		telemetry_dir = template_dir + "/telemetry";
+	if( sensor_map_path.empty() )
+		sensor_map_path = template_dir + "/sensor_map";
+#ifdef MOCK
+	for(std::size_t i = layouts.size(); i < sim_rigs; ++i)
+		layouts.push_back(simulatedRigLayout(i));
+#endif
+	if( layouts.empty() )
+		layouts.push_back(RigLayout{});
+	for(std::size_t i = 0; i < layouts.size(); ++i)
+	{
+		layouts[i].setProbePins(i);
+		for(std::size_t j = 0; j < i; ++j)
+		{
+			if( layouts[j].name == layouts[i].name )
+			{
+				std::cerr << "two rigs are named " << layouts[i].name << std::endl;
+				return -1;
+			}
+			// or both would drive the same relays
+			for(auto&& a : RigLayout::pins())
+				for(auto&& b : RigLayout::pins())
+					if( layouts[i].*a.second == layouts[j].*b.second )
+					{
+						std::cerr << "rigs " << layouts[j].name << " and " << layouts[i].name << " both use pin " << layouts[i].*a.second
+							<< " (" << b.first << " and " << a.first << ")" << std::endl;
+						return -1;
+					}
+		}
+	}
+	// the probes keep the devices last picked for them
+	SensorMap sensor_map(sensor_map_path);
+	for(auto&& l : layouts)
+		sensor_map.apply(l);
+#ifdef MOCK
+	// before anything starts reading the clock
+	Clock::setSpeed(sim_speed);
+	for(auto&& l : layouts)
+		setupSimulation(l);
+	PlantSim::global().start();
+#endif
+
+	// in realtime mode the control path gets the last core to itself at RT
+	// priority and the web server gets the rest; with more than one rig their
+	// control threads take the cores from the last one down, ahead of the web
+	// server at RT priority
+	const int rt_cpu = cpu_count() - 1;
+	std::vector<int> web_cpus;
+	for(int cpu = 0; cpu < rt_cpu; ++cpu)
+		web_cpus.push_back(cpu);
+	if( realtime )
+	{
+		lock_memory();
+		// threads started while building the brewery inherit this, which is how
+		// the scheduler's workers and the control thread end up on the RT core
+		set_current_cpu_affinity({rt_cpu});
+		set_realtime_priority(pthread_self(), 60);
+		// except the background startup tasks, which block on sysfs, the 1-wire bus
+		// and the gpio utility; wiringPi's interrupt threads start from these and
+		// raise themselves to RT priority, just not on the RT core
+		startup.onThreadStart([web_cpus]{
+				set_realtime_priority(pthread_self(), 0);
+				if( not web_cpus.empty() )
+					set_current_cpu_affinity(web_cpus);
+			});
 	}
 
-    app.route_dynamic("/",
-    [&]{
+	// outlives the breweries, whose components log into it
+	startup.begin("telemetry_replay");
+	TelemetryLog telemetry(telemetry_dir);
+	startup.end("telemetry_replay");
+	// the first scan of the bus, so the config tab has something to list
+	startup.background("i2c_inventory", []{I2CInventory::global().rescan();});
+	startup.begin("rigs");
+	std::vector<std::unique_ptr<Rig>> rigs;
+	for(auto&& l : layouts)
+		rigs.push_back(std::make_unique<Rig>(l));
+	startup.end("rigs");
+	startup.begin("telemetry_restore");
+	for(auto&& rig : rigs)
+	{
+		attachTelemetry(rig->brewery, telemetry, "");
+		attachTelemetry(rig->brewery.heaterControl(), telemetry, rig->prefix() + "/hlt");
+	}
+	startup.end("telemetry_restore");
+	if( realtime )
+	{
+		for(std::size_t i = 0; i < rigs.size(); ++i)
+		{
+			set_realtime_priority(rigs[i]->control.nativeHandle(), 80);
+			set_cpu_affinity(rigs[i]->control.nativeHandle(), {rt_cpu - static_cast<int>(i % std::max(1, rt_cpu))});
+		}
+		for(auto&& h : Scheduler::global().nativeHandles())
+			set_realtime_priority(h, 70);
+		// sensor conversions and fsyncs block, so they stay off the RT core at normal priority
+		for(auto&& h : Scheduler::io().nativeHandles())
+		{
+			set_realtime_priority(h, 0);
+			if( not web_cpus.empty() )
+				set_cpu_affinity(h, web_cpus);
+		}
+		// crow's threads are started from this one
+		set_realtime_priority(pthread_self(), 0);
+		if( not web_cpus.empty() )
+			set_current_cpu_affinity(web_cpus);
+	}
+	// created after the above so it runs with the web server
+	startup.begin("web");
+	Scheduler web_sched(1);
+	for(auto&& rig : rigs)
+		rig->brewery.connect(rig->control);
+
+	crow_mustache_set_base(template_dir);
+	AssetTable assets(template_dir + "/static");
+	app.route_dynamic("/assets/<path>",
+	[&](const CrowRequest& req, std::string path){
+		return assets.respond(path, req);
+	});
+	// the component tree is fixed, so the page only changes when the template does
+	CachedPage main_page(template_dir + "/static_main.html",
+	[&]{
 		JSONWrapper ctx;
 		ctx.set("title", "brewery controller test");
-		ctx.set("brewery_layout", generateLayout(brewery));
-		ctx.set("update_js", generateUpdateJS(brewery, {}));
+		ctx.set("asset_version", assets.getVersion());
+		std::string layout, update_js, sensor_config, sensor_config_js, mash_schedules;
+		for(auto&& rig : rigs)
+		{
+			auto& b = rig->brewery;
+			mash_schedules += "<option value=\"" + rig->prefix() + "/hlt/" + b.mashSchedule().getName() + "\">" + b.getName() + "</option>\n";
+			// more than one rig and each gets its own fieldset
+			layout += rigs.size() == 1 ? generateLayout(b) : generateLayout(static_cast<Brewery::ComponentTuple&>(b));
+			update_js += generateUpdateJS(b, {});
+			for(auto&& probe : rig->layout.probes())
+			{
+				auto id = b.getName() + "_" + probe.name;
+				sensor_config += "<fieldset>\n\t<label for=\"" + id + "\">" + b.getName() + " " + probe.name + " I2C device: </label>\n"
+					"\t<select name=\"" + id + "\" id=\"" + id + "\"></select>\n</fieldset>\n";
+				sensor_config_js += "registerSelect(\"/i2c/list\", \"#" + id + "\", \"/i2c/" + b.getName() + "/" + probe.name + "_id\");\n";
+			}
+		}
+		ctx.set("brewery_layout", layout);
+		ctx.set("update_js", update_js);
+		ctx.set("sensor_config", sensor_config);
+		ctx.set("sensor_config_js", sensor_config_js);
+		ctx.set("mash_schedules", mash_schedules);
 		return crow_mustache_load("static_main.html", ctx);
-    });
+	});
+	main_page.get();
+	app.route_dynamic("/",
+	[&](const CrowRequest& req){
+		return main_page.get()->respond(req);
+	});
 	app.route_dynamic("/reboot",
 	[&]{
 		system("sudo shutdown -r now");
@@ -151,46 +604,169 @@ int main(int argc, char* argv[])
 		return "";
 	});
 	app.route_dynamic("/i2c/status",
-	[&]() -> std::string {
-		if( is_i2c_setup() )
-			return "true";
-		return "false";
+	[&](JSONWriter& w){
+		w.value(is_i2c_setup());
 	});
+	// polled by every open page; a client that already has the current version just gets that back
 	app.route_dynamic("/i2c/list",
-	[&]{
-		std::string ret("[");
-		bool first = true;
-		for(auto&& e : get_i2c_devices())
+	[&](JSONWriter& w, const CrowRequest& req){
+		auto& inventory = I2CInventory::global();
+		auto version = inventory.getVersion();
+		if( req.url_params_get("version") == std::to_string(version) )
+		{
+			w.beginObject().field("version", version).endObject();
+			return;
+		}
+		thread_local std::vector<I2CInventory::Device> devices;
+		version = inventory.get(devices);
+		w.beginObject().field("version", version).key("devices").beginArray();
+		for(auto&& d : devices)
 		{
-			if( first )
-				first = false;
+			w.beginObject();
+			w.field("value", d.id);
+			w.field("family", d.family);
+			w.key("celsius");
+			if( d.have_reading )
+				w.value(d.celsius);
 			else
-				ret += ",";
-			ret += "{\"value\":\"";
-			ret += e;
-			ret += "\"}";
+				w.null();
+			w.field("read_time", d.read_time);
+			w.field("reads", d.reads);
+			w.field("read_errors", d.read_errors);
+			w.endObject();
 		}
-		ret += "]";
-		return ret;
+		w.endArray().endObject();
 	});
-	app.route_dynamic("/i2c/hlt_temp_id/set/<string>",
-	[&](std::string deviceId) -> std::string {
-		return setI2CDeviceForPin(HLT_TEMP_PIN, deviceId) ? "{\"value\":\"true\"}" : "{\"value\":\"false\"}";
+	for(auto&& rig : rigs)
+		for(auto&& probe : rig->layout.probes())
+		{
+			auto endpoint = "/i2c/" + rig->layout.name + "/" + probe.name + "_id";
+			auto pin = probe.pin;
+			app.route_dynamic(endpoint + "/set/<string>",
+			[&sensor_map, pin, rig_name=rig->layout.name, probe_name=probe.name](JSONWriter& w, std::string deviceId){
+				bool ok = setI2CDeviceForPin(pin, deviceId);
+				if( ok )
+					sensor_map.set(rig_name, probe_name, deviceId);
+				w.beginObject().field("value", ok).endObject();
+			});
+			app.route_dynamic(endpoint + "/get",
+			[pin](JSONWriter& w){
+				w.beginObject().field("value", getI2CDeviceForPin(pin)).endObject();
+			});
+		}
+
+	app.route_dynamic("/scheduler/status",
+	[&](JSONWriter& w){
+		std::vector<Scheduler::TaskStats> stats = Scheduler::global().stats();
+		for(auto&& s : web_sched.stats())
+			stats.push_back(s);
+		w.beginArray();
+		for(auto&& s : stats)
+		{
+			w.beginObject();
+			w.field("name", s.name);
+			w.field("period_us", s.period.count());
+			w.field("runs", s.runs);
+			w.field("overruns", s.overruns);
+			w.field("last_jitter_us", s.last_jitter.count());
+			w.field("max_jitter_us", s.max_jitter.count());
+			w.field("mean_jitter_us", s.runs ? s.total_jitter.count() / s.runs : 0);
+			w.field("last_runtime_us", s.last_runtime.count());
+			w.field("max_runtime_us", s.max_runtime.count());
+			s.jitter_histogram.toJSON(w.key("jitter_histogram"));
+			s.runtime_histogram.toJSON(w.key("runtime_histogram"));
+			w.endObject();
+		}
+		w.endArray();
 	});
-	app.route_dynamic("/i2c/hlt_temp_id/get",
-	[&]() -> std::string {
-		return "{\"value\": \"" + getI2CDeviceForPin(HLT_TEMP_PIN) + "\"}";
+
+	app.route_dynamic("/control/status",
+	[&](JSONWriter& w){
+		w.beginArray();
+		std::vector<ControlLoop::ControllerStats> stats;
+		for(auto&& rig : rigs)
+			for(auto&& s : rig->control.stats())
+				stats.push_back(s);
+		for(auto&& s : stats)
+		{
+			w.beginObject();
+			w.field("name", s.name);
+			w.field("runs", s.runs);
+			w.field("last_latency_us", s.last_latency.count());
+			w.field("max_latency_us", s.max_latency.count());
+			w.field("last_runtime_us", s.last_runtime.count());
+			w.field("max_runtime_us", s.max_runtime.count());
+			s.latency_histogram.toJSON(w.key("latency_histogram"));
+			s.runtime_histogram.toJSON(w.key("runtime_histogram"));
+			w.endObject();
+		}
+		w.endArray();
 	});
-	app.route_dynamic("/i2c/pump_temp_id/set/<string>",
-	[&](std::string deviceId) -> std::string {
-		return setI2CDeviceForPin(PUMP_ASSEMBLY_TEMP_PIN, deviceId) ? "{\"value\":\"true\"}" : "{\"value\":\"false\"}";
+
+	RouteTable routes;
+	for(auto&& rig : rigs)
+	{
+		registerEndpoints(rig->brewery, routes, "");
+		registerEndpoints(rig->brewery.heaterControl(), routes, rig->prefix() + "/hlt");
+		registerEndpoints(rig->brewery.mashSchedule(), routes, rig->prefix() + "/hlt");
+		registerMetrics(rig->brewery, MetricsRegistry::global(), "");
+	}
+	app.mount(std::move(routes));
+	app.route_dynamic("/metrics",
+	[&](const CrowRequest&){
+		return SimpleResponse{200, {{"Content-Type", "text/plain; version=0.0.4"}}, MetricsRegistry::global().exposition()};
 	});
-	app.route_dynamic("/i2c/pump_temp_id/get",
-	[&]() -> std::string {
-		return "{\"value\": \"" + getI2CDeviceForPin(PUMP_ASSEMBLY_TEMP_PIN) + "\"}";
+	// every 100ms of real time, however fast the clock is running
+	PeriodicTask push_task("status_push", [&](){
+		for(auto&& rig : rigs)
+		{
+			pushStatus(rig->brewery, app, "");
+			pushStatus(rig->brewery.mashSchedule(), app, rig->prefix() + "/hlt");
+		}
+	}, Clock::fromRealMs(100), web_sched);
+
+	// for tools that exercise the server, like tools/loadgen
+	app.route_dynamic("/routes",
+	[&](JSONWriter& w){
+		w.beginArray();
+		for(auto&& r : app.routes())
+			w.value(r);
+		w.endArray();
 	});
 
-	registerEndpoints(brewery, app,"");
+	// 503 until the hardware set up in the background is done, for boot scripts and monitoring
+	app.route_dynamic("/ready",
+	[&](const CrowRequest&){
+		SimpleResponse res{200, {{"Content-Type", "application/json"}}, ""};
+		JSONWriter w(res.body);
+		bool ready = startup.ready();
+		w.beginObject().field("ready", ready).key("phases").beginArray();
+		for(auto&& p : startup.getPhases())
+		{
+			using std::chrono::duration_cast;
+			using std::chrono::milliseconds;
+			w.beginObject();
+			w.field("name", p.name);
+			w.field("start_ms", duration_cast<milliseconds>(p.start).count());
+			w.field("took_ms", duration_cast<milliseconds>(p.took).count());
+			w.field("pending", p.pending);
+			w.endObject();
+		}
+		w.endArray().endObject();
+		if( not ready )
+			res.code = 503;
+		return res;
+	});
 
-	app.run_on_port(40080);
+	startup.end("web");
+	startup.markServing();
+	app.run_on_port(port);
+	// the background setup uses the components too
+	startup.stop();
+	// the controllers use the breweries, so stop them before they go away
+	for(auto&& rig : rigs)
+		rig->control.stop();
+#ifdef MOCK
+	PlantSim::global().stop();
+#endif
 }
@@ -0,0 +1,74 @@
+#include "clock.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+struct Origin {
+	std::chrono::steady_clock::time_point real = std::chrono::steady_clock::now();
+	std::chrono::system_clock::time_point epoch = std::chrono::system_clock::now();
+	Clock::duration base{0}; // clock time at real
+	double speed = 1;
+};
+Origin& origin()
+{
+	static Origin o;
+	return o;
+}
+thread_local const Clock::time_point* frozen = nullptr;
+}
+
+Clock::time_point Clock::now()
+{
+	if( frozen )
+		return *frozen;
+	auto& o = origin();
+	auto elapsed = std::chrono::steady_clock::now() - o.real;
+	if( o.speed == 1 )
+		return time_point(o.base + elapsed);
+	return time_point(o.base + std::chrono::duration_cast<duration>(elapsed * o.speed));
+}
+
+std::size_t Clock::epochSeconds()
+{
+	auto since = origin().epoch.time_since_epoch() + now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::seconds>(since).count();
+}
+
+void Clock::setSpeed(double speed)
+{
+	auto& o = origin();
+	// carry on from the current time so nothing sees it jump
+	o.base = now().time_since_epoch();
+	o.real = std::chrono::steady_clock::now();
+	o.speed = speed > 0 ? speed : 1;
+}
+
+double Clock::getSpeed()
+{
+	return origin().speed;
+}
+
+std::chrono::steady_clock::duration Clock::toReal(duration d)
+{
+	auto speed = origin().speed;
+	if( speed == 1 )
+		return d;
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(d / speed);
+}
+
+unsigned Clock::fromRealMs(unsigned real_ms)
+{
+	auto ms = std::llround(real_ms * origin().speed);
+	return static_cast<unsigned>(std::clamp<long long>(ms, 1, std::numeric_limits<unsigned>::max()));
+}
+
+Clock::Frozen::Frozen(time_point t) : t(t), previous(frozen)
+{
+	frozen = &this->t;
+}
+
+Clock::Frozen::~Frozen()
+{
+	frozen = previous;
+}
@@ -0,0 +1,119 @@
+#include "control_loop.h"
+#include <algorithm>
+
+namespace {
+std::chrono::microseconds to_us(ControlLoop::clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d);
+}
+}
+
+ControlLoop::ControlLoop(clock::duration heartbeat) :
+	heartbeat(heartbeat),
+	thread([this]{run();})
+{}
+
+ControlLoop::~ControlLoop()
+{
+	stop();
+}
+
+void ControlLoop::stop()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		finished = true;
+	}
+	cv.notify_all();
+	if( thread.joinable() and thread.get_id() != std::this_thread::get_id() )
+		thread.join();
+}
+
+ControlLoop::ControllerId ControlLoop::add(std::string name, std::function<void()> func)
+{
+	auto c = std::make_unique<Controller>();
+	c->func = std::move(func);
+	c->stats.name = std::move(name);
+	auto& metrics = MetricsRegistry::global();
+	c->latency_metric = &metrics.histogram("brewery_control_trigger_latency_seconds", "Time from an input changing to its controller running.", 1e-6, {{"controller", c->stats.name}});
+	c->runtime_metric = &metrics.histogram("brewery_control_run_duration_seconds", "Time spent in one run of a controller.", 1e-6, {{"controller", c->stats.name}});
+	// run it once up front so outputs start from the current state
+	c->dirty = true;
+	c->marked = clock::now();
+	std::lock_guard<std::mutex> g{mut};
+	controllers.push_back(std::move(c));
+	cv.notify_all();
+	return controllers.size() - 1;
+}
+
+void ControlLoop::markDirty(ControllerId id)
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		auto& c = *controllers.at(id);
+		if( c.dirty )
+			return;
+		c.dirty = true;
+		c.marked = clock::now();
+	}
+	cv.notify_all();
+}
+
+void ControlLoop::dependsOn(ControllerId id, TempSensor& t)
+{
+	t.onSample([this, id](const TempSample&) {markDirty(id);});
+}
+
+std::vector<ControlLoop::ControllerStats> ControlLoop::stats()
+{
+	std::lock_guard<std::mutex> g{mut};
+	std::vector<ControllerStats> ret;
+	for(auto&& c : controllers)
+		ret.push_back(c->stats);
+	return ret;
+}
+
+void ControlLoop::run()
+{
+	std::unique_lock<std::mutex> lk{mut};
+	auto next_beat = clock::now() + heartbeat;
+	while( not finished )
+	{
+		auto dirty = std::find_if(controllers.begin(), controllers.end(), [](auto&& c){return c->dirty;});
+		if( dirty == controllers.end() )
+		{
+			if( Clock::wait_until(cv, lk, next_beat) == std::cv_status::timeout )
+			{
+				auto now = clock::now();
+				for(auto&& c : controllers)
+				{
+					if( not c->dirty )
+					{
+						c->dirty = true;
+						c->marked = now;
+					}
+				}
+				next_beat = now + heartbeat;
+			}
+			continue;
+		}
+		// controllers are never removed, so this stays valid while unlocked
+		Controller& c = **dirty;
+		c.dirty = false;
+		auto start = clock::now();
+		lk.unlock();
+		c.func();
+		auto end = clock::now();
+		lk.lock();
+		auto& s = c.stats;
+		++s.runs;
+		s.last_latency = to_us(start - c.marked);
+		s.max_latency = std::max(s.max_latency, s.last_latency);
+		s.latency_histogram.add(s.last_latency);
+		c.latency_metric->observe(s.last_latency);
+		s.last_runtime = to_us(end - start);
+		s.max_runtime = std::max(s.max_runtime, s.last_runtime);
+		s.runtime_histogram.add(s.last_runtime);
+		c.runtime_metric->observe(s.last_runtime);
+	}
+}
@@ -1,6 +1,12 @@
 #include "crow_integration.h"
+#include "metrics.h"
+#include "route_table.h"
 #define CROW_MAIN
 #include "crow.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
 
 void crow_mustache_set_base(std::string base)
 {
@@ -17,26 +23,10 @@ JSONWrapper::JSONWrapper() : impl(new crow::json::wvalue)
 JSONWrapper::JSONWrapper(const JSONWrapper& rhs) : impl(new crow::json::wvalue(*rhs.impl))
 {
 }
-void JSONWrapper::set(std::string value)
-{
-	*impl = value;
-}
-void JSONWrapper::set(unsigned int index, JSONWrapper value)
-{
-	(*impl)[index] = crow::json::wvalue(*value.impl);
-}
 void JSONWrapper::set(std::string id, std::string value)
 {
 	(*impl)[id] = value;
 }
-void JSONWrapper::set(std::string id, JSONWrapper value)
-{
-	(*impl)[id] = crow::json::wvalue(*value.impl);
-}
-std::string JSONWrapper::dump()
-{
-	return impl->dump();
-}
 crow::json::wvalue& JSONWrapper::to_wvalue()
 {
 	return *impl;
@@ -51,7 +41,12 @@ CrowRequest::CrowRequest(const crow::request& req) : req(&req)
 }
 std::string CrowRequest::url_params_get(std::string param) const
 {
-	return req->url_params.get(param);
+	auto value = req->url_params.get(param);
+	return value ? value : "";
+}
+std::string CrowRequest::get_header(std::string name) const
+{
+	return req->get_header_value(name);
 }
 
 std::string crow_mustache_load(std::string file, JSONWrapper ctx)
@@ -64,27 +59,212 @@ void SimpleApp::Deleter::operator()(crow::Crow<>* app)
 {
 	delete app;
 }
-SimpleApp::SimpleApp() : impl(new crow::SimpleApp) 
+struct SimpleApp::PushChannel {
+	std::mutex mut;
+	std::set<crow::websocket::connection*> clients;
+	std::map<std::string, std::string> last;
+};
+SimpleApp::SimpleApp() : impl(new crow::SimpleApp), push_channel(std::make_shared<PushChannel>())
+{
+	auto channel = push_channel;
+	CROW_WEBSOCKET_ROUTE((*impl), "/push")
+		.onopen([channel](crow::websocket::connection& conn) {
+				std::lock_guard<std::mutex> g{channel->mut};
+				channel->clients.insert(&conn);
+				for(auto&& m : channel->last)
+					conn.send_text(m.second);
+			})
+		// close handlers gained a status code argument in later crow versions
+		.onclose([channel](crow::websocket::connection& conn, const std::string&, auto&&...) {
+				std::lock_guard<std::mutex> g{channel->mut};
+				channel->clients.erase(&conn);
+			});
+}
+namespace {
+struct RouteMetrics {
+	Histogram& latency;
+	Histogram& bytes;
+};
+RouteMetrics route_metrics(const std::string& endPoint)
+{
+	auto& reg = MetricsRegistry::global();
+	return {
+		reg.histogram("brewery_http_request_duration_seconds", "Time spent in a route's handler.", 1e-6, {{"route", endPoint}}),
+		reg.histogram("brewery_http_response_bytes", "Size of a route's response body.", 1, {{"route", endPoint}})
+	};
+}
+std::size_t body_size(const std::string& body) {return body.size();}
+std::size_t body_size(const crow::response& res) {return res.body.size();}
+template<class F>
+auto timed(const RouteMetrics& m, F&& f)
 {
+	auto start = std::chrono::steady_clock::now();
+	auto ret = f();
+	m.latency.observe(std::chrono::steady_clock::now() - start);
+	m.bytes.observe(body_size(ret));
+	return ret;
 }
+
+template<class F>
+std::string write_json(F&& f)
+{
+	thread_local std::string buffer;
+	buffer.clear();
+	JSONWriter w(buffer);
+	f(w);
+	// crow keeps the body, so this copy is the one allocation left
+	return buffer;
+}
+
+crow::response to_crow_response(SimpleResponse r)
+{
+	crow::response res(r.code);
+	for(auto&& h : r.headers)
+		res.set_header(h.first, h.second);
+	res.body = std::move(r.body);
+	return res;
+}
+}
+
 void SimpleApp::route_dynamic(std::string endPoint, std::function<std::string()> exec)
 {
-	impl->route_dynamic(std::move(endPoint))(exec);
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=] {
+			return timed(m, exec);
+		});
 }
 void SimpleApp::route_dynamic(std::string endPoint, std::function<std::string(int)> exec)
 {
-	impl->route_dynamic(std::move(endPoint))(exec);
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](int param) {
+			return timed(m, [&]{return exec(param);});
+		});
 }
 void SimpleApp::route_dynamic(std::string endPoint, std::function<std::string(std::string)> exec)
 {
-	impl->route_dynamic(std::move(endPoint))(exec);
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](std::string param) {
+			return timed(m, [&]{return exec(std::move(param));});
+		});
 }
 void SimpleApp::route_dynamic(std::string endPoint, std::function<std::string(const CrowRequest&)> exec)
 {
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](const crow::request& req) {
+			return timed(m, [&]{return exec(CrowRequest(req));});
+		});
+}
+void SimpleApp::route_dynamic(std::string endPoint, std::function<SimpleResponse(const CrowRequest&)> exec)
+{
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
 	impl->route_dynamic(std::move(endPoint))([=](const crow::request& req) {
-			return exec(CrowRequest(req));
+			return timed(m, [&]{return to_crow_response(exec(CrowRequest(req)));});
+		});
+}
+void SimpleApp::route_dynamic(std::string endPoint, std::function<SimpleResponse(const CrowRequest&, std::string)> exec)
+{
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](const crow::request& req, std::string param) {
+			return timed(m, [&]{return to_crow_response(exec(CrowRequest(req), std::move(param)));});
+		});
+}
+void SimpleApp::route_dynamic(std::string endPoint, std::function<void(JSONWriter&)> exec)
+{
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=] {
+			return timed(m, [&]{return write_json(exec);});
+		});
+}
+void SimpleApp::route_dynamic(std::string endPoint, std::function<void(JSONWriter&, int)> exec)
+{
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](int param) {
+			return timed(m, [&]{return write_json([&](JSONWriter& w){exec(w, param);});});
+		});
+}
+void SimpleApp::route_dynamic(std::string endPoint, std::function<void(JSONWriter&, std::string)> exec)
+{
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](std::string param) {
+			return timed(m, [&]{return write_json([&](JSONWriter& w){exec(w, std::move(param));});});
 		});
 }
+void SimpleApp::route_dynamic(std::string endPoint, std::function<void(JSONWriter&, const CrowRequest&)> exec)
+{
+	auto m = route_metrics(endPoint);
+	route_list.push_back(endPoint);
+	impl->route_dynamic(std::move(endPoint))([=](const crow::request& req) {
+			return timed(m, [&]{return write_json([&](JSONWriter& w){exec(w, CrowRequest(req));});});
+		});
+}
+
+void SimpleApp::mount(RouteTable routes)
+{
+	routes.freeze();
+	auto table = std::make_shared<const RouteTable>(std::move(routes));
+	// per route, in table order
+	auto metrics = std::make_shared<std::vector<RouteMetrics>>();
+	std::set<std::string> roots;
+	for(auto&& r : table->all())
+	{
+		auto name = r.indexed ? r.path + "/<int>" : r.path;
+		metrics->push_back(route_metrics(name));
+		route_list.push_back(name);
+		roots.insert(r.path.substr(0, r.path.find('/', 1)));
+	}
+	for(auto&& root : roots)
+		impl->route_dynamic(root + "/<path>")([table, metrics](const crow::request& req, std::string) {
+				std::size_t index = 0;
+				auto route = table->find(req.url, index);
+				if( not route )
+					return crow::response(404);
+				return timed((*metrics)[route - table->all().data()], [&]{
+						CrowRequest creq(req);
+						int code = 200;
+						auto body = write_json([&](JSONWriter& w){code = route->handler(route->component, {creq, index}, w);});
+						crow::response res(code);
+						res.body = std::move(body);
+						return res;
+					});
+			});
+}
+
+void SimpleApp::push(const std::string& topic, std::string_view message)
+{
+	std::lock_guard<std::mutex> g{push_channel->mut};
+	auto& last = push_channel->last[topic];
+	if( last == message )
+		return;
+	// assigning into the old message reuses its storage
+	last.assign(message);
+	for(auto&& conn : push_channel->clients)
+		conn->send_text(last);
+}
+
+SimpleResponse SimpleApp::dispatch(std::string url)
+{
+	std::call_once(routes_validated, [this]{impl->validate();});
+	crow::request req;
+	req.method = crow::HTTPMethod::Get;
+	req.raw_url = url;
+	req.url = url.substr(0, url.find('?'));
+	req.url_params = crow::query_string(url);
+	crow::response res;
+	impl->handle(req, res);
+	SimpleResponse ret;
+	ret.code = res.code;
+	ret.body = std::move(res.body);
+	return ret;
+}
 
 void SimpleApp::loglevel(SimpleApp::LogLevels level)
 {
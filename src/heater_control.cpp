@@ -0,0 +1,314 @@
+#include "heater_control.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+PIDController::PIDController(Gains gains, double out_min, double out_max) :
+	gains(gains),
+	out_min(out_min),
+	out_max(out_max)
+{}
+
+double PIDController::update(double setpoint, double measurement, double dt)
+{
+	double error = setpoint - measurement;
+	terms.p = gains.kp * error;
+	if( dt > 0 )
+	{
+		if( primed )
+			terms.d = -gains.kd * (measurement - last_measurement) / dt;
+		last_measurement = measurement;
+		primed = true;
+
+		double unclamped = terms.p + terms.i + terms.d;
+		bool wound_high = unclamped >= out_max and error > 0;
+		bool wound_low = unclamped <= out_min and error < 0;
+		if( not wound_high and not wound_low )
+			terms.i += gains.ki * error * dt;
+		terms.i = std::clamp(terms.i, out_min, out_max);
+	}
+	terms.output = std::clamp(terms.p + terms.i + terms.d, out_min, out_max);
+	return terms.output;
+}
+
+void PIDController::reset()
+{
+	primed = false;
+	terms = {};
+}
+
+void RelayAutotune::start(double sp, double hyst, unsigned c)
+{
+	state = Running;
+	setpoint = sp;
+	hysteresis = hyst;
+	// the first cycle starts from wherever the temperature was, so it's thrown away
+	cycles = std::max(c, 2u);
+	primed = false;
+	highs.clear();
+	lows.clear();
+	rises.clear();
+}
+
+double RelayAutotune::update(double measurement, std::size_t time)
+{
+	if( state != Running )
+		return 0;
+	if( not primed )
+	{
+		primed = true;
+		started = time;
+		on = measurement < setpoint;
+		peak_high = peak_low = measurement;
+	}
+	if( time - started > MaxSeconds )
+	{
+		state = Failed;
+		return 0;
+	}
+	if( on )
+	{
+		peak_low = std::min(peak_low, measurement);
+		if( measurement > setpoint + hysteresis )
+		{
+			on = false;
+			rises.push_back(time);
+			lows.push_back(peak_low);
+			peak_high = measurement;
+		}
+	}
+	else
+	{
+		peak_high = std::max(peak_high, measurement);
+		if( measurement < setpoint - hysteresis )
+		{
+			on = true;
+			highs.push_back(peak_high);
+			peak_low = measurement;
+		}
+	}
+	if( rises.size() > cycles )
+	{
+		finish();
+		return 0;
+	}
+	return on ? 1 : 0;
+}
+
+void RelayAutotune::finish()
+{
+	auto mean = [](auto first, auto last) {
+		return std::accumulate(first, last, 0.0) / (last - first);
+	};
+	double amplitude = (mean(highs.begin()+1, highs.end()) - mean(lows.begin()+1, lows.end())) / 2;
+	double period = double(rises.back() - rises.front()) / (rises.size() - 1);
+	if( amplitude <= 0 or period <= 0 )
+	{
+		state = Failed;
+		return;
+	}
+	// the relay swings the output between 0 and 1
+	constexpr double relay_amplitude = 0.5;
+	ultimate_gain = 4 * relay_amplitude / (M_PI * amplitude);
+	ultimate_period = period;
+	double kp = ultimate_gain / 2.2;
+	double ti = 2.2 * period;
+	double td = period / 6.3;
+	result = {kp, kp / ti, kp * td};
+	state = Done;
+}
+
+TimeProportionedOutput::TimeProportionedOutput(std::string name, std::function<void(bool)> output, unsigned ms_window, unsigned ms_resolution, Scheduler& sched) :
+	output(std::move(output)),
+	window(std::chrono::milliseconds(ms_window))
+{
+	this->output(false);
+	task = std::make_unique<PeriodicTask>(name, [this]{tick();}, ms_resolution, sched);
+}
+
+TimeProportionedOutput::~TimeProportionedOutput()
+{
+	task.reset();
+	output(false);
+}
+
+void TimeProportionedOutput::setDuty(double d)
+{
+	duty.store(std::clamp(d, 0.0, 1.0));
+}
+
+void TimeProportionedOutput::tick()
+{
+	auto now = Scheduler::clock::now();
+	if( not started or now - window_start >= window )
+	{
+		window_start = now;
+		started = true;
+	}
+	bool on = now - window_start < std::chrono::duration_cast<Scheduler::clock::duration>(window * duty.load());
+	if( on != is_on )
+	{
+		is_on = on;
+		output(on);
+	}
+}
+
+HeaterController::HeaterController(std::string name, Heater& heater, TempSensor& sensor, PIDController::Gains gains, unsigned ms_window) :
+	Named(name),
+	heater(heater),
+	sensor(sensor),
+	pid(gains),
+	output(name, [&heater](bool on) {
+			if( on )
+				heater.on();
+			else
+				heater.off();
+		}, ms_window)
+{}
+
+void HeaterController::update()
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto& history = sensor.getHistory();
+	TempSample sample;
+	bool have = history.latest(sample);
+	// a sample appended between these two reads is just picked up next time
+	auto seq = history.size();
+	stale = not have or time_in_seconds() > sample.time + StaleSeconds;
+	if( stale or mode == Off )
+	{
+		if( stale and mode == Autotune )
+		{
+			autotune.cancel();
+			mode = Auto;
+		}
+		pid.reset();
+		last_time = 0;
+		output.setDuty(0);
+		return;
+	}
+	bool fresh = seq != last_seq;
+	last_temp = sample.temp;
+	double dt = fresh and last_time ? double(sample.time - last_time) : 0;
+	if( fresh )
+	{
+		last_seq = seq;
+		last_time = sample.time;
+	}
+	if( mode == Autotune )
+	{
+		if( fresh )
+			output.setDuty(autotune.update(sample.temp, sample.time));
+		if( autotune.getState() == RelayAutotune::Done )
+		{
+			changeGains(autotune.getResult());
+			pid.reset();
+			mode = Auto;
+		}
+		else if( autotune.getState() == RelayAutotune::Failed )
+		{
+			pid.reset();
+			mode = Auto;
+		}
+		else
+			return;
+	}
+	output.setDuty(pid.update(heater.get(), sample.temp, dt));
+}
+
+void HeaterController::changeGains(PIDController::Gains g)
+{
+	pid.setGains(g);
+	for(auto&& f : gainsListeners)
+		f(g);
+}
+
+void HeaterController::setMode(Mode m)
+{
+	std::lock_guard<std::mutex> g{mut};
+	if( m == mode )
+		return;
+	if( m == Autotune )
+		autotune.start(heater.get());
+	else
+		autotune.cancel();
+	pid.reset();
+	last_time = 0;
+	mode = m;
+	// the rest waits for the next update, but turning off shouldn't
+	if( m == Off )
+		output.setDuty(0);
+}
+
+HeaterController::Mode HeaterController::getMode()
+{
+	std::lock_guard<std::mutex> g{mut};
+	return mode;
+}
+
+void HeaterController::setGains(PIDController::Gains gains)
+{
+	std::lock_guard<std::mutex> g{mut};
+	changeGains(gains);
+}
+
+bool HeaterController::validGains(const PIDController::Gains& g)
+{
+	for(auto v : {g.kp, g.ki, g.kd})
+		if( not std::isfinite(v) or v < 0 )
+			return false;
+	return true;
+}
+
+PIDController::Gains HeaterController::getGains()
+{
+	std::lock_guard<std::mutex> g{mut};
+	return pid.getGains();
+}
+
+HeaterController::Status HeaterController::getStatus()
+{
+	std::lock_guard<std::mutex> g{mut};
+	return {mode, stale, heater.get(), last_temp, output.getDuty(), pid.getTerms(), pid.getGains(), autotune.getState()};
+}
+
+void HeaterController::onGainsChange(std::function<void(PIDController::Gains)> f)
+{
+	gainsListeners.push_back(std::move(f));
+}
+
+const char* HeaterController::modeName(Mode m)
+{
+	switch(m)
+	{
+	case Off: return "off";
+	case Auto: return "auto";
+	case Autotune: return "autotune";
+	}
+	return "";
+}
+
+bool HeaterController::parseMode(const std::string& s, Mode& m)
+{
+	for(auto candidate : {Off, Auto, Autotune})
+	{
+		if( s == modeName(candidate) )
+		{
+			m = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* HeaterController::autotuneStateName(RelayAutotune::State s)
+{
+	switch(s)
+	{
+	case RelayAutotune::Idle: return "idle";
+	case RelayAutotune::Running: return "running";
+	case RelayAutotune::Done: return "done";
+	case RelayAutotune::Failed: return "failed";
+	}
+	return "";
+}
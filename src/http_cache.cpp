@@ -0,0 +1,254 @@
+#include "http_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+std::string gzip_compress(const std::string& in)
+{
+	z_stream zs{};
+	// 15 window bits, +16 for a gzip header rather than raw zlib
+	if( deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15+16, 9, Z_DEFAULT_STRATEGY) != Z_OK )
+		return {};
+	std::string out(deflateBound(&zs, in.size()), '\0');
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+	zs.avail_in = in.size();
+	zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	zs.avail_out = out.size();
+	auto ret = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	if( ret != Z_STREAM_END )
+		return {};
+	return out;
+}
+
+std::string make_etag(const std::string& in)
+{
+	// 64 bit FNV-1a
+	std::uint64_t hash = 14695981039346656037ull;
+	for(unsigned char c : in)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	char buf[24];
+	std::snprintf(buf, sizeof(buf), "\"%016llx\"", static_cast<unsigned long long>(hash));
+	return buf;
+}
+
+CachedContent::CachedContent(std::string b, std::string content_type, std::string cache_control) :
+	content_type(std::move(content_type)),
+	cache_control(std::move(cache_control)),
+	body(std::move(b)),
+	gzipped(gzip_compress(body)),
+	etag(make_etag(body))
+{
+	// not worth sending compressed if it didnt get smaller
+	if( gzipped.size() >= body.size() )
+		gzipped.clear();
+}
+
+namespace {
+enum RangeResult {NoRange, Satisfiable, Unsatisfiable};
+bool parse_size(std::string_view s, std::size_t& v)
+{
+	auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+	return not s.empty() and res.ec == std::errc{} and res.ptr == s.data() + s.size();
+}
+// parses "bytes=first-last", "bytes=first-" or "bytes=-suffix"; anything else,
+// including several ranges, is ignored and the whole body sent
+RangeResult parse_range(std::string_view range, std::size_t size, std::size_t& first, std::size_t& last)
+{
+	const std::string_view unit = "bytes=";
+	if( range.substr(0, unit.size()) != unit )
+		return NoRange;
+	range.remove_prefix(unit.size());
+	auto dash = range.find('-');
+	if( dash == std::string_view::npos )
+		return NoRange;
+	auto lhs = range.substr(0, dash);
+	auto rhs = range.substr(dash + 1);
+	if( lhs.empty() )
+	{
+		std::size_t suffix;
+		if( not parse_size(rhs, suffix) or suffix == 0 )
+			return NoRange;
+		if( size == 0 )
+			return Unsatisfiable;
+		first = suffix >= size ? 0 : size - suffix;
+		last = size - 1;
+		return Satisfiable;
+	}
+	if( not parse_size(lhs, first) )
+		return NoRange;
+	last = std::numeric_limits<std::size_t>::max();
+	if( not rhs.empty() and (not parse_size(rhs, last) or last < first) )
+		return NoRange;
+	if( first >= size )
+		return Unsatisfiable;
+	last = std::min(last, size - 1);
+	return Satisfiable;
+}
+}
+
+SimpleResponse CachedContent::respond(const CrowRequest& req) const
+{
+	SimpleResponse ret;
+	ret.headers.push_back({"ETag", etag});
+	ret.headers.push_back({"Cache-Control", cache_control});
+	ret.headers.push_back({"Vary", "Accept-Encoding"});
+	ret.headers.push_back({"Accept-Ranges", "bytes"});
+	auto match = req.get_header("If-None-Match");
+	if( match == "*" or match.find(etag) != std::string::npos )
+	{
+		ret.code = 304;
+		return ret;
+	}
+	ret.headers.push_back({"Content-Type", content_type});
+	// ranges always refer to the uncompressed body
+	auto range = req.get_header("Range");
+	std::size_t first, last;
+	switch( parse_range(range, body.size(), first, last) )
+	{
+	case Unsatisfiable:
+		ret.code = 416;
+		ret.headers.push_back({"Content-Range", "bytes */" + std::to_string(body.size())});
+		return ret;
+	case Satisfiable:
+		ret.code = 206;
+		ret.headers.push_back({"Content-Range", "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(body.size())});
+		ret.body = body.substr(first, last - first + 1);
+		return ret;
+	case NoRange:
+		break;
+	}
+	if( not gzipped.empty() and req.get_header("Accept-Encoding").find("gzip") != std::string::npos )
+	{
+		ret.headers.push_back({"Content-Encoding", "gzip"});
+		ret.body = gzipped;
+	}
+	else
+		ret.body = body;
+	return ret;
+}
+
+CachedPage::CachedPage(std::filesystem::path file, std::function<std::string()> render, std::string content_type) :
+	file(std::move(file)),
+	render(std::move(render)),
+	content_type(std::move(content_type))
+{}
+
+std::shared_ptr<const CachedContent> CachedPage::get()
+{
+	std::error_code ec;
+	auto cur = std::filesystem::last_write_time(file, ec);
+	std::lock_guard<std::mutex> g{mut};
+	if( not content or (not ec and cur != mtime) )
+	{
+		mtime = cur;
+		content = std::make_shared<const CachedContent>(render(), content_type);
+	}
+	return content;
+}
+
+namespace {
+std::string content_type_for(const std::filesystem::path& file)
+{
+	static const std::map<std::string, std::string> types = {
+		{".html", "text/html"},
+		{".css", "text/css"},
+		{".js", "application/javascript"},
+		{".json", "application/json"},
+		{".map", "application/json"},
+		{".txt", "text/plain"},
+		{".png", "image/png"},
+		{".gif", "image/gif"},
+		{".jpg", "image/jpeg"},
+		{".svg", "image/svg+xml"},
+		{".ico", "image/x-icon"},
+	};
+	auto it = types.find(file.extension().string());
+	if( it == types.end() )
+		return "application/octet-stream";
+	return it->second;
+}
+}
+
+AssetTable::AssetTable(std::filesystem::path dir)
+{
+	struct Unique {
+		std::string body;
+		std::string content_type;
+		std::shared_ptr<const CachedContent> content;
+	};
+	std::map<std::string, Unique> by_etag;
+	std::vector<std::pair<std::string, std::string>> names; // and their etags
+	std::error_code ec;
+	for(auto&& entry : std::filesystem::recursive_directory_iterator{dir, ec})
+	{
+		if( not entry.is_regular_file() )
+			continue;
+		std::ifstream in(entry.path(), std::ios::binary);
+		std::string body{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+		auto etag = make_etag(body);
+		auto& u = by_etag[etag];
+		if( u.body.empty() )
+		{
+			u.body = std::move(body);
+			u.content_type = content_type_for(entry.path());
+		}
+		names.push_back({std::filesystem::relative(entry.path(), dir).generic_string(), etag});
+	}
+	// compressing is most of the startup time on a pi, so spread it over the cores
+	std::vector<Unique*> work;
+	for(auto&& u : by_etag)
+		work.push_back(&u.second);
+	std::atomic<std::size_t> next{0};
+	auto compress = [&]{
+		for(auto i = next++; i < work.size(); i = next++)
+			work[i]->content = std::make_shared<const CachedContent>(std::move(work[i]->body), work[i]->content_type, "public, max-age=31536000, immutable");
+	};
+	std::vector<std::thread> workers;
+	for(unsigned t = 1; t < std::min<std::size_t>(std::thread::hardware_concurrency(), work.size()); ++t)
+		workers.emplace_back(compress);
+	compress();
+	for(auto&& t : workers)
+		t.join();
+	for(auto&& n : names)
+		assets[n.first] = by_etag[n.second].content;
+	// map ordering keeps this stable from run to run
+	std::string etags;
+	for(auto&& a : assets)
+		etags += a.first + a.second->getETag();
+	version = make_etag(etags).substr(1, 16);
+}
+
+SimpleResponse AssetTable::respond(const std::string& path, const CrowRequest& req) const
+{
+	auto slash = path.find('/');
+	auto it = slash == std::string::npos ? assets.end() : assets.find(path.substr(slash + 1));
+	if( it == assets.end() )
+	{
+		SimpleResponse ret;
+		ret.code = 404;
+		return ret;
+	}
+	auto ret = it->second->respond(req);
+	if( path.compare(0, slash, version) != 0 )
+	{
+		// an old version asked for by a stale page; serve what we have but dont let it stick
+		for(auto&& h : ret.headers)
+			if( h.first == "Cache-Control" )
+				h.second = "no-cache";
+	}
+	return ret;
+}
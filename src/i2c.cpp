@@ -1,4 +1,5 @@
 #include "i2c.h"
+#include <algorithm>
 #include <filesystem>
 	
 const std::filesystem::path devices_path{"/sys/bus/w1/devices"};
@@ -10,42 +11,212 @@ bool is_i2c_setup()
 
 const std::string prefix = "28-";
 
-std::vector<std::string> get_i2c_devices()
+namespace {
+struct Found {
+	std::string family;
+	std::string id;
+};
+// the slow part; sysfs blocks while the bus is busy
+std::vector<Found> scan_bus()
 {
-	std::vector<std::string> ret;
+	std::vector<Found> ret;
 #ifdef MOCK
-	ret.push_back("050505");
-	ret.push_back("3A3A3A");
+	ret.push_back({"28", "050505"});
+	ret.push_back({"28", "3A3A3A"});
 #else
-	for (auto const& dir_entry : std::filesystem::directory_iterator{devices_path})
+	std::error_code ec;
+	for (auto const& dir_entry : std::filesystem::directory_iterator{devices_path, ec})
 	{
+		// devices are <family>-<id>; the bus masters have no dash
 		std::string name = dir_entry.path().filename().string();
-		if( name != "w1_bus_master1" )
-			ret.push_back(name.substr(prefix.size())); //strip off prefix
+		auto dash = name.find('-');
+		if( dash != std::string::npos )
+			ret.push_back({name.substr(0, dash), name.substr(dash+1)});
 	}
 #endif
+	std::sort(ret.begin(), ret.end(), [](const Found& a, const Found& b){return a.id < b.id;});
+	return ret;
+}
+}
+
+std::vector<std::string> get_i2c_devices()
+{
+	std::vector<I2CInventory::Device> devices;
+	I2CInventory::global().get(devices);
+	std::vector<std::string> ret;
+	for(auto&& d : devices)
+		ret.push_back(d.id);
 	return ret;
 }
 
+I2CInventory::I2CInventory(unsigned ms_tick, unsigned ticks_per_scan, Scheduler& sched) :
+	rescan_requested(true),
+	ticks_per_scan(ticks_per_scan),
+	rescan_task("i2c_inventory", [this](){tick();}, ms_tick, sched)
+{}
+
+I2CInventory& I2CInventory::global()
+{
+	// the bus goes at its own pace, however fast the clock is running
+	static I2CInventory inventory(Clock::fromRealMs(1000));
+	return inventory;
+}
+
+void I2CInventory::tick()
+{
+	if( rescan_requested.exchange(false) or ++ticks >= ticks_per_scan )
+	{
+		ticks = 0;
+		rescan();
+	}
+}
+
+void I2CInventory::rescan()
+{
+	auto found = scan_bus();
+	std::lock_guard<std::mutex> g{mut};
+	// devices still there keep their readings and counts
+	bool changed = found.size() != devices.size();
+	std::vector<Device> next;
+	for(auto&& f : found)
+	{
+		auto it = std::lower_bound(devices.begin(), devices.end(), f.id, [](const Device& d, const std::string& id){return d.id < id;});
+		if( it != devices.end() and it->id == f.id and it->family == f.family )
+			next.push_back(std::move(*it));
+		else
+		{
+			changed = true;
+			next.push_back({f.id, f.family});
+		}
+	}
+	devices = std::move(next);
+	if( changed )
+		++version;
+}
+
+std::uint64_t I2CInventory::getVersion()
+{
+	std::lock_guard<std::mutex> g{mut};
+	return version;
+}
+
+std::uint64_t I2CInventory::get(std::vector<Device>& out)
+{
+	std::lock_guard<std::mutex> g{mut};
+	out = devices;
+	return version;
+}
+
+void I2CInventory::recordRead(const std::string& id, bool ok, double celsius)
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto it = std::lower_bound(devices.begin(), devices.end(), id, [](const Device& d, const std::string& id){return d.id < id;});
+	// mapped but not listed; the next scan will tell
+	if( it == devices.end() or it->id != id )
+		return;
+	++it->reads;
+	if( ok )
+	{
+		it->have_reading = true;
+		it->celsius = celsius;
+		it->read_time = Clock::epochSeconds();
+	}
+	else
+	{
+		++it->read_errors;
+		// it may have dropped off the bus
+		rescan_requested = true;
+	}
+}
+
 #include <map>
+#include <mutex>
 
+std::mutex pin_to_device_id_mut;
 std::map<int, std::string> pin_to_device_id;
 
 extern "C" int ds18b20Setup (const int pinBase, const char *deviceId);
 
+// wiringPi's node list isnt thread safe, and sensors are set up in parallel at startup
+std::mutex setup_mut;
+
 bool setI2CDeviceForPin(int pin, std::string device_id)
 {
+	std::lock_guard<std::mutex> setup{setup_mut};
+	{
+		std::lock_guard<std::mutex> g{pin_to_device_id_mut};
+		for(auto&& m : pin_to_device_id)
+			if( m.first != pin and m.second == device_id )
+				return false;
+	}
 	auto ret = ds18b20Setup(pin, device_id.c_str());
 	if( ret )
+	{
+		std::lock_guard<std::mutex> g{pin_to_device_id_mut};
 		pin_to_device_id[pin] = device_id;
+	}
 	return ret;
 }
 
 std::string getI2CDeviceForPin(int pin)
 {
+	std::lock_guard<std::mutex> g{pin_to_device_id_mut};
 	if( pin_to_device_id.count(pin) )
 		return pin_to_device_id[pin];
 	else
 		return "[unmapped]";
 }
 
+bool isI2CDeviceMapped(int pin)
+{
+	std::lock_guard<std::mutex> g{pin_to_device_id_mut};
+	return pin_to_device_id.count(pin);
+}
+
+#include <fstream>
+#include <thread>
+
+bool i2c_bulk_convert(unsigned timeout_ms)
+{
+#ifdef MOCK
+	(void)timeout_ms;
+	return false;
+#else
+	auto bulk_path = devices_path / "w1_bus_master1" / "therm_bulk_read";
+	{
+		std::ofstream trigger(bulk_path);
+		if( not (trigger << "trigger" << std::flush) )
+			return false;
+	}
+	// reads -1 while converting, 1 once every sensor has a fresh value
+	using namespace std::chrono_literals;
+	for(unsigned waited = 0; waited <= timeout_ms; waited += 50)
+	{
+		std::ifstream status(bulk_path);
+		int s = 0;
+		if( not (status >> s) )
+			return false;
+		if( s == 1 )
+			return true;
+		std::this_thread::sleep_for(50ms);
+	}
+	return false;
+#endif
+}
+
+bool read_i2c_temp_celsius(std::string device_id, double& celsius)
+{
+#ifdef MOCK
+	(void)device_id;
+	(void)celsius;
+	return false;
+#else
+	std::ifstream in(devices_path / (prefix + device_id) / "temperature");
+	long millidegrees;
+	bool ok = static_cast<bool>(in >> millidegrees);
+	if( ok )
+		celsius = millidegrees / 1000.0;
+	return ok;
+#endif
+}
+
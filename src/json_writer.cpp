@@ -0,0 +1,59 @@
+#include "json_writer.h"
+#include <charconv>
+#include <cmath>
+
+void JSONWriter::writeInteger(std::int64_t v)
+{
+	char buf[24];
+	auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+	out.append(buf, end);
+}
+
+void JSONWriter::writeUnsigned(std::uint64_t v)
+{
+	char buf[24];
+	auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+	out.append(buf, end);
+}
+
+void JSONWriter::writeDouble(double v)
+{
+	if( not std::isfinite(v) )
+	{
+		out += "null";
+		return;
+	}
+	char buf[32];
+	auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+	out.append(buf, end);
+}
+
+void JSONWriter::writeString(std::string_view s)
+{
+	static const char hex[] = "0123456789abcdef";
+	out += '"';
+	// copy runs of plain characters at once; names and ids rarely need escaping
+	std::size_t run = 0;
+	for(std::size_t i = 0; i < s.size(); ++i)
+	{
+		unsigned char c = s[i];
+		if( c >= 0x20 and c != '"' and c != '\\' )
+			continue;
+		out.append(s.data() + run, i - run);
+		run = i + 1;
+		switch( c )
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			out += "\\u00";
+			out += hex[c >> 4];
+			out += hex[c & 0xf];
+		}
+	}
+	out.append(s.data() + run, s.size() - run);
+	out += '"';
+}
@@ -0,0 +1,236 @@
+#include "mash_schedule.h"
+#include "heater_control.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+MashSchedule::MashSchedule(std::string name, Heater& heater, const TempHistory& history) :
+	Named(name),
+	heater(heater),
+	history(history)
+{}
+
+void MashSchedule::update()
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto now = time_in_seconds();
+	TempSample sample;
+	have_temp = history.latest(sample) and now <= sample.time + HeaterController::StaleSeconds;
+	if( have_temp )
+		last_temp = sample.temp;
+	if( paused )
+		return;
+	// a step already at temp with no hold is passed straight through
+	while( state == Ramping or state == Holding )
+	{
+		auto& s = steps[step];
+		if( state == Ramping )
+		{
+			if( not have_temp or std::abs(last_temp - s.temp) > HoldBand )
+			{
+				setHeater(rampSetpoint(s, now));
+				return;
+			}
+			state = Holding;
+			hold_start = now;
+			setHeater(s.temp);
+		}
+		if( now < hold_start + s.hold )
+			return;
+		begin(step+1, now);
+	}
+}
+
+void MashSchedule::begin(std::size_t index, std::size_t now)
+{
+	step = index;
+	if( step >= steps.size() )
+	{
+		// the heater stays at the last step's temperature
+		state = Done;
+		paused = false;
+		return;
+	}
+	state = Ramping;
+	step_start = now;
+	ramp_from = have_temp ? last_temp : heater.get();
+	set_once = false;
+	by_hand = false;
+}
+
+double MashSchedule::rampSetpoint(const Step& s, std::size_t now) const
+{
+	if( s.ramp <= 0 )
+		return s.temp;
+	double moved = s.ramp * (now - step_start) / 60;
+	if( ramp_from < s.temp )
+		return std::min(s.temp, ramp_from + moved);
+	return std::max(s.temp, ramp_from - moved);
+}
+
+void MashSchedule::setHeater(double v)
+{
+	// a target set by hand holds until the next step, ramp or not
+	if( set_once and heater.get() != last_set )
+		by_hand = true;
+	if( by_hand )
+		return;
+	v = std::clamp(v, heater.getMin(), heater.getMax());
+	if( set_once and v == last_set )
+		return;
+	last_set = v;
+	set_once = true;
+	heater.set(v);
+}
+
+void MashSchedule::commanded()
+{
+	for(auto&& f : commandListeners)
+		f();
+}
+
+bool MashSchedule::reachable(const std::vector<Step>& s)
+{
+	return std::all_of(s.begin(), s.end(), [this](const Step& step){
+			return step.temp >= heater.getMin() and step.temp <= heater.getMax();
+		});
+}
+
+bool MashSchedule::setSteps(std::vector<Step> s)
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		if( state == Ramping or state == Holding )
+			return false;
+		steps = std::move(s);
+		state = Idle;
+		paused = false;
+	}
+	commanded();
+	return true;
+}
+
+bool MashSchedule::start()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		if( steps.empty() )
+			return false;
+		paused = false;
+		begin(0, time_in_seconds());
+	}
+	commanded();
+	return true;
+}
+
+bool MashSchedule::pause()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		if( paused or (state != Ramping and state != Holding) )
+			return false;
+		paused = true;
+		paused_at = time_in_seconds();
+	}
+	commanded();
+	return true;
+}
+
+bool MashSchedule::resume()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		if( not paused )
+			return false;
+		// carry on as if the pause never happened
+		auto away = time_in_seconds() - paused_at;
+		step_start += away;
+		hold_start += away;
+		paused = false;
+	}
+	commanded();
+	return true;
+}
+
+bool MashSchedule::skip()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		if( state != Ramping and state != Holding )
+			return false;
+		auto now = time_in_seconds();
+		begin(step+1, now);
+		if( paused )
+			paused_at = now;
+	}
+	commanded();
+	return true;
+}
+
+bool MashSchedule::stop()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		if( state != Ramping and state != Holding )
+			return false;
+		state = Idle;
+		paused = false;
+	}
+	commanded();
+	return true;
+}
+
+MashSchedule::Status MashSchedule::getStatus()
+{
+	std::lock_guard<std::mutex> g{mut};
+	std::size_t hold_left = 0;
+	if( state == Ramping )
+		hold_left = steps[step].hold;
+	else if( state == Holding )
+	{
+		auto now = paused ? paused_at : time_in_seconds();
+		auto end = hold_start + steps[step].hold;
+		hold_left = now < end ? end - now : 0;
+	}
+	return {state, paused, step, heater.get(), last_temp, hold_left, steps};
+}
+
+void MashSchedule::onCommand(std::function<void()> f)
+{
+	commandListeners.push_back(std::move(f));
+}
+
+const char* MashSchedule::stateName(State s)
+{
+	switch(s)
+	{
+	case Idle: return "idle";
+	case Ramping: return "ramping";
+	case Holding: return "holding";
+	case Done: return "done";
+	}
+	return "";
+}
+
+bool MashSchedule::parseSteps(const std::string& s, std::vector<Step>& out)
+{
+	std::vector<Step> ret;
+	std::stringstream list(s);
+	std::string item;
+	while( std::getline(list, item, ',') )
+	{
+		std::stringstream fields(item);
+		double temp, minutes, ramp = 0;
+		char sep;
+		if( not (fields >> temp >> sep >> minutes) or sep != ':' )
+			return false;
+		// an optional ramp, then nothing
+		if( fields >> sep and (sep != ':' or not (fields >> ramp) or fields >> sep) )
+			return false;
+		if( not std::isfinite(temp) or not std::isfinite(minutes) or not std::isfinite(ramp) or minutes < 0 or ramp < 0 )
+			return false;
+		ret.push_back({temp, static_cast<std::size_t>(std::lround(minutes * 60)), ramp});
+	}
+	out = std::move(ret);
+	return true;
+}
@@ -0,0 +1,178 @@
+#include "metrics.h"
+#include <cstdio>
+
+std::size_t Details::metric_shard()
+{
+	static std::atomic<std::size_t> next{0};
+	thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % MetricShards;
+	return shard;
+}
+
+namespace {
+std::string format_number(double v)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.9g", v);
+	return buf;
+}
+
+std::string escape_label(const std::string& v)
+{
+	std::string ret;
+	for(auto c : v)
+	{
+		if( c == '\\' or c == '"' )
+			ret += '\\';
+		if( c == '\n' )
+		{
+			ret += "\\n";
+			continue;
+		}
+		ret += c;
+	}
+	return ret;
+}
+
+std::string braced(const std::string& labels, const std::string& extra={})
+{
+	if( labels.empty() and extra.empty() )
+		return {};
+	if( labels.empty() or extra.empty() )
+		return "{" + labels + extra + "}";
+	return "{" + labels + "," + extra + "}";
+}
+}
+
+std::uint64_t Counter::value() const
+{
+	std::uint64_t ret = 0;
+	for(auto&& s : shards)
+		ret += s.value.load(std::memory_order_relaxed);
+	return ret;
+}
+
+void Histogram::write(std::string& out, const std::string& name, const std::string& labels) const
+{
+	std::uint64_t counts[Buckets] = {};
+	std::uint64_t sum = 0;
+	for(auto&& s : shards)
+	{
+		for(std::size_t i = 0; i < Buckets; ++i)
+			counts[i] += s.counts[i].load(std::memory_order_relaxed);
+		sum += s.sum.load(std::memory_order_relaxed);
+	}
+	// prometheus buckets are cumulative and inclusive of their bound
+	std::uint64_t total = 0;
+	for(std::size_t i = 0; i+1 < Buckets; ++i)
+	{
+		total += counts[i];
+		double le = ((std::uint64_t(1) << i) - 1) * scale;
+		out += name + "_bucket" + braced(labels, "le=\"" + format_number(le) + "\"") + " " + std::to_string(total) + "\n";
+	}
+	total += counts[Buckets-1];
+	out += name + "_bucket" + braced(labels, "le=\"+Inf\"") + " " + std::to_string(total) + "\n";
+	out += name + "_sum" + braced(labels) + " " + format_number(sum * scale) + "\n";
+	out += name + "_count" + braced(labels) + " " + std::to_string(total) + "\n";
+}
+
+MetricsRegistry& MetricsRegistry::global()
+{
+	static MetricsRegistry reg;
+	return reg;
+}
+
+MetricsRegistry::Series& MetricsRegistry::series(const std::string& name, const std::string& help, Type type, const Labels& labels)
+{
+	std::string rendered;
+	for(auto&& l : labels)
+	{
+		if( not rendered.empty() )
+			rendered += ",";
+		rendered += l.first + "=\"" + escape_label(l.second) + "\"";
+	}
+	auto& family = families[name];
+	if( family.series.empty() )
+	{
+		family.help = help;
+		family.type = type;
+	}
+	for(auto&& s : family.series)
+		if( s.labels == rendered )
+			return s;
+	family.series.push_back({rendered, nullptr, nullptr, nullptr});
+	return family.series.back();
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const Labels& labels)
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto& s = series(name, help, CounterType, labels);
+	if( not s.counter )
+		s.counter = std::make_unique<Counter>();
+	return *s.counter;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, double scale, const Labels& labels)
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto& s = series(name, help, HistogramType, labels);
+	if( not s.histogram )
+		s.histogram = std::make_unique<Histogram>(scale);
+	return *s.histogram;
+}
+
+void MetricsRegistry::gauge(const std::string& name, const std::string& help, std::function<double()> f, const Labels& labels)
+{
+	std::lock_guard<std::mutex> g{mut};
+	series(name, help, GaugeType, labels).sample = std::move(f);
+}
+
+void MetricsRegistry::sampledCounter(const std::string& name, const std::string& help, std::function<double()> f, const Labels& labels)
+{
+	std::lock_guard<std::mutex> g{mut};
+	series(name, help, CounterType, labels).sample = std::move(f);
+}
+
+std::string MetricsRegistry::exposition()
+{
+	static const char* type_names[] = {"counter", "gauge", "histogram"};
+	std::string out;
+	std::lock_guard<std::mutex> g{mut};
+	for(auto&& f : families)
+	{
+		auto& name = f.first;
+		out += "# HELP " + name + " " + f.second.help + "\n";
+		out += "# TYPE " + name + " " + type_names[f.second.type] + "\n";
+		for(auto&& s : f.second.series)
+		{
+			if( s.histogram )
+				s.histogram->write(out, name, s.labels);
+			else if( s.counter )
+				out += name + braced(s.labels) + " " + std::to_string(s.counter->value()) + "\n";
+			else if( s.sample )
+				out += name + braced(s.labels) + " " + format_number(s.sample()) + "\n";
+		}
+	}
+	return out;
+}
+
+void registerMetrics(TempSensor& t, MetricsRegistry& reg, std::string pathPrefix)
+{
+	MetricsRegistry::Labels labels{{"component", pathPrefix+"/"+t.getName()}};
+	reg.gauge("brewery_temperature_fahrenheit", "Latest temperature sample.",
+		[&t]{return t.getTempF();}, labels);
+	reg.gauge("brewery_temp_history_samples", "Samples appended to a temperature history.",
+		[&t]{return static_cast<double>(t.getHistory().size());}, labels);
+	reg.gauge("brewery_temp_history_bytes", "Memory held by a temperature history.",
+		[&t]{return static_cast<double>(t.getHistory().memoryBytes());}, labels);
+}
+
+void registerMetrics(FlowSensor& f, MetricsRegistry& reg, std::string pathPrefix)
+{
+	MetricsRegistry::Labels labels{{"component", pathPrefix+"/"+f.getName()}};
+	registerMetrics(static_cast<ReadableValue<double>&>(f), reg, pathPrefix);
+	reg.sampledCounter("brewery_flow_edges_total", "Edges counted by a flow sensor's interrupt.",
+		[&f]{return static_cast<double>(f.getEdgeCounter().getEdges());}, labels);
+	reg.gauge("brewery_flow_edges_per_second", "Recent interrupt edge rate of a flow sensor.",
+		[&f]{return f.getEdgeCounter().edgesPerSecond(FlowSensor::RateWindow);}, labels);
+}
@@ -0,0 +1,180 @@
+#include "plant_sim.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr double JoulesPerLiterDegree = 4186; // water
+double seconds(Clock::duration d)
+{
+	return std::chrono::duration<double>(d).count();
+}
+}
+
+PlantSim& PlantSim::global()
+{
+	static PlantSim sim;
+	return sim;
+}
+
+PlantSim::~PlantSim()
+{
+	stop();
+}
+
+std::size_t PlantSim::addVessel(VesselConfig v)
+{
+	std::lock_guard<std::mutex> g{mut};
+	vessels.push_back({v, v.start_celsius});
+	return vessels.size() - 1;
+}
+
+void PlantSim::addProbe(ProbeConfig p)
+{
+	std::lock_guard<std::mutex> g{mut};
+	probes.push_back({p, {}, vessels.at(p.vessel).celsius});
+}
+
+void PlantSim::addFlow(FlowConfig f)
+{
+	std::lock_guard<std::mutex> g{mut};
+	flows.push_back({f});
+}
+
+void PlantSim::start(std::chrono::milliseconds real_step)
+{
+	std::lock_guard<std::mutex> g{mut};
+	if( running )
+		return;
+	running = true;
+	last_step = Clock::now();
+	thread = std::thread([this, real_step]{
+			for(;;)
+			{
+				std::this_thread::sleep_for(real_step);
+				{
+					std::lock_guard<std::mutex> g{mut};
+					if( not running )
+						return;
+				}
+				step();
+			}
+		});
+}
+
+void PlantSim::stop()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		running = false;
+	}
+	if( thread.joinable() )
+		thread.join();
+}
+
+double PlantSim::takeOnSeconds(int pin, Clock::time_point now)
+{
+	auto it = pins.find(pin);
+	if( it == pins.end() )
+		return 0;
+	auto& p = it->second;
+	if( p.on )
+		p.on_seconds += seconds(now - p.since);
+	p.since = now;
+	return std::exchange(p.on_seconds, 0.0);
+}
+
+void PlantSim::step()
+{
+	std::vector<std::pair<Clock::time_point, std::pair<Isr, void*>>> edges;
+	{
+		std::lock_guard<std::mutex> g{mut};
+		auto now = Clock::now();
+		double dt = seconds(now - last_step);
+		if( dt <= 0 )
+			return;
+
+		for(auto&& v : vessels)
+		{
+			// on time rather than the pin's current state, so switching inside a step counts
+			double joules = v.config.heater_watts * takeOnSeconds(v.config.heater_pin, now)
+				- v.config.loss_watts_per_degree * (v.celsius - ambient_celsius) * dt;
+			v.celsius += joules / (v.config.liters * JoulesPerLiterDegree);
+		}
+
+		for(auto&& p : probes)
+		{
+			p.in_transit.push_back({now, vessels[p.config.vessel].celsius});
+			double arrived = p.sensed;
+			auto cutoff = now - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(p.config.dead_seconds));
+			while( not p.in_transit.empty() and p.in_transit.front().first <= cutoff )
+			{
+				arrived = p.in_transit.front().second;
+				p.in_transit.pop_front();
+			}
+			double alpha = p.config.lag_seconds > 0 ? 1 - std::exp(-dt / p.config.lag_seconds) : 1;
+			p.sensed += (arrived - p.sensed) * alpha;
+		}
+
+		for(auto&& f : flows)
+		{
+			bool flowing = true;
+			for(auto pin : f.config.enable_pins)
+				flowing = flowing and pins[pin].on;
+			auto isr = isrs.find(f.config.pin);
+			if( not flowing or isr == isrs.end() )
+				continue;
+			f.pending_edges += f.config.liters_per_minute / 60 * f.config.edges_per_liter * dt;
+			auto count = static_cast<std::size_t>(f.pending_edges);
+			f.pending_edges -= count;
+			// the pulses of the coming step, spread evenly over it and stamped with when they
+			// happen; delivering them a step early keeps readers from ever seeing a gap
+			// in the pulse train between steps, which would look like the flow slowing
+			for(std::size_t i = 1; i <= count; ++i)
+				edges.push_back({now + (now - last_step) * i / count, isr->second});
+		}
+		last_step = now;
+	}
+	// outside the lock, the handlers may well read pins
+	std::sort(edges.begin(), edges.end(), [](auto&& a, auto&& b){return a.first < b.first;});
+	for(auto&& e : edges)
+	{
+		Clock::Frozen at(e.first);
+		e.second.first(e.second.second);
+	}
+}
+
+void PlantSim::digitalWrite(int pin, int value)
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto now = Clock::now();
+	auto& p = pins[pin];
+	if( p.on )
+		p.on_seconds += seconds(now - p.since);
+	p.since = now;
+	p.on = value != 0;
+}
+
+int PlantSim::analogRead(int pin)
+{
+	std::lock_guard<std::mutex> g{mut};
+	for(auto&& p : probes)
+	{
+		if( p.config.pin != pin )
+			continue;
+		std::normal_distribution<double> noise(0, p.config.noise_celsius);
+		return static_cast<int>(std::lround((p.sensed + noise(rng)) * 10));
+	}
+	return 0;
+}
+
+void PlantSim::registerIsr(int pin, Isr f, void* data)
+{
+	std::lock_guard<std::mutex> g{mut};
+	isrs[pin] = {f, data};
+}
+
+double PlantSim::vesselCelsius(std::size_t vessel)
+{
+	std::lock_guard<std::mutex> g{mut};
+	return vessels.at(vessel).celsius;
+}
@@ -0,0 +1,84 @@
+#include "realtime.h"
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+bool report(const char* what, int err)
+{
+	if( err == 0 )
+		return true;
+	std::cerr << what << " failed: " << std::strerror(err) << std::endl;
+	return false;
+}
+
+void touch_stack(std::size_t bytes)
+{
+	// volatile so the writes aren't optimised away
+	volatile char* stack = static_cast<volatile char*>(alloca(bytes));
+	for(std::size_t i = 0; i < bytes; i += 4096)
+		stack[i] = 0;
+}
+}
+
+bool lock_memory(std::size_t heap_bytes, std::size_t stack_bytes, std::size_t thread_stack_bytes)
+{
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	auto err = pthread_attr_setstacksize(&attr, thread_stack_bytes);
+	if( err == 0 )
+		err = pthread_setattr_default_np(&attr);
+	pthread_attr_destroy(&attr);
+	if( not report("pthread_setattr_default_np", err) )
+		return false;
+	if( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 )
+		return report("mlockall", errno);
+	// keep freed memory in the process, and dont satisfy big allocations with
+	// fresh mmaps, so allocating later never has to fault pages in
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if( heap_bytes )
+	{
+		auto heap = static_cast<char*>(malloc(heap_bytes));
+		if( heap == nullptr )
+			return report("heap prefault", ENOMEM);
+		for(std::size_t i = 0; i < heap_bytes; i += 4096)
+			heap[i] = 0;
+		free(heap);
+	}
+	touch_stack(stack_bytes);
+	return true;
+}
+
+bool set_realtime_priority(std::thread::native_handle_type thread, int priority)
+{
+	sched_param param{};
+	param.sched_priority = priority;
+	return report("pthread_setschedparam", pthread_setschedparam(thread, priority ? SCHED_FIFO : SCHED_OTHER, &param));
+}
+
+bool set_cpu_affinity(std::thread::native_handle_type thread, const std::vector<int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(auto cpu : cpus)
+		CPU_SET(cpu, &set);
+	return report("pthread_setaffinity_np", pthread_setaffinity_np(thread, sizeof(set), &set));
+}
+
+bool set_current_cpu_affinity(const std::vector<int>& cpus)
+{
+	return set_cpu_affinity(pthread_self(), cpus);
+}
+
+int cpu_count()
+{
+	auto n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? static_cast<int>(n) : 1;
+}
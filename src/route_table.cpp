@@ -0,0 +1,59 @@
+#include "route_table.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+bool before(const RouteTable::Route& r, std::string_view path, bool indexed)
+{
+	auto c = std::string_view(r.path).compare(path);
+	return c < 0 or (c == 0 and r.indexed < indexed);
+}
+}
+
+void RouteTable::insert(std::string path, bool indexed, Handler handler, void* component)
+{
+	routes.push_back({std::move(path), indexed, handler, component});
+	sorted = false;
+}
+
+void RouteTable::freeze()
+{
+	if( sorted )
+		return;
+	std::stable_sort(routes.begin(), routes.end(), [](const Route& a, const Route& b) {
+			return before(a, b.path, b.indexed);
+		});
+	// the first one added wins
+	auto dup = std::unique(routes.begin(), routes.end(), [](const Route& a, const Route& b) {
+			if( a.path != b.path or a.indexed != b.indexed )
+				return false;
+			std::cerr << "route " << b.path << " registered twice, ignoring the second" << std::endl;
+			return true;
+		});
+	routes.erase(dup, routes.end());
+	sorted = true;
+}
+
+const RouteTable::Route* RouteTable::find(std::string_view path, std::size_t& index) const
+{
+	auto lookup = [&](std::string_view p, bool indexed) -> const Route* {
+		auto it = std::lower_bound(routes.begin(), routes.end(), p, [&](const Route& r, std::string_view v) {
+				return before(r, v, indexed);
+			});
+		if( it != routes.end() and it->path == p and it->indexed == indexed )
+			return &*it;
+		return nullptr;
+	};
+	if( auto r = lookup(path, false) )
+		return r;
+	auto slash = path.rfind('/');
+	if( slash == std::string_view::npos or slash+1 == path.size() )
+		return nullptr;
+	auto number = path.substr(slash+1);
+	if( number.size() > 18 or not std::all_of(number.begin(), number.end(), [](char c){return c >= '0' and c <= '9';}) )
+		return nullptr;
+	index = 0;
+	for(auto c : number)
+		index = index*10 + (c - '0');
+	return lookup(path.substr(0, slash), true);
+}
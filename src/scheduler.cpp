@@ -0,0 +1,151 @@
+#include "scheduler.h"
+#include <algorithm>
+
+namespace {
+thread_local Scheduler::TaskId current_task = 0;
+
+std::chrono::microseconds to_us(Scheduler::clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d);
+}
+}
+
+Scheduler::Scheduler(unsigned num_workers)
+{
+	if( num_workers == 0 )
+		num_workers = 1;
+	for(unsigned i = 0; i < num_workers; ++i)
+		workers.emplace_back([this]{worker();});
+}
+
+Scheduler::~Scheduler()
+{
+	{
+		std::lock_guard<std::mutex> g{mut};
+		finished = true;
+	}
+	cv.notify_all();
+	for(auto&& w : workers)
+		w.join();
+}
+
+Scheduler& Scheduler::global()
+{
+	static Scheduler sched(4);
+	return sched;
+}
+
+Scheduler& Scheduler::io()
+{
+	static Scheduler sched(2);
+	return sched;
+}
+
+void Scheduler::schedule(clock::time_point when, TaskId id)
+{
+	deadlines.push_back({when, id});
+	std::push_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>{});
+}
+
+Scheduler::TaskId Scheduler::add(std::string name, std::function<void()> func, clock::duration period)
+{
+	auto task = std::make_shared<Task>();
+	task->func = std::move(func);
+	// the worker divides by it
+	task->period = std::max(period, clock::duration(1));
+	task->stats.name = std::move(name);
+	task->stats.period = to_us(task->period);
+	TaskId id;
+	{
+		std::lock_guard<std::mutex> g{mut};
+		id = next_id++;
+		tasks[id] = task;
+		schedule(clock::now(), id);
+	}
+	cv.notify_all();
+	return id;
+}
+
+void Scheduler::cancel(TaskId id)
+{
+	std::unique_lock<std::mutex> lk{mut};
+	tasks.erase(id);
+	// the stale heap entry is dropped when it reaches the top
+	if( current_task != id )
+		cv.wait(lk, [&]{return running.count(id) == 0;});
+}
+
+std::vector<Scheduler::TaskStats> Scheduler::stats()
+{
+	std::lock_guard<std::mutex> g{mut};
+	std::vector<TaskStats> ret;
+	for(auto&& t : tasks)
+		ret.push_back(t.second->stats);
+	return ret;
+}
+
+std::vector<std::thread::native_handle_type> Scheduler::nativeHandles()
+{
+	std::vector<std::thread::native_handle_type> ret;
+	for(auto&& w : workers)
+		ret.push_back(w.native_handle());
+	return ret;
+}
+
+void Scheduler::worker()
+{
+	std::unique_lock<std::mutex> lk{mut};
+	while( !finished )
+	{
+		if( deadlines.empty() )
+		{
+			cv.wait(lk);
+			continue;
+		}
+		auto deadline = deadlines.front();
+		if( clock::now() < deadline.first )
+		{
+			Clock::wait_until(cv, lk, deadline.first);
+			continue;
+		}
+		std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<Deadline>{});
+		deadlines.pop_back();
+		auto it = tasks.find(deadline.second);
+		if( it == tasks.end() )
+			continue;
+		auto task = it->second;
+		running.insert(deadline.second);
+		auto start = clock::now();
+		lk.unlock();
+
+		current_task = deadline.second;
+		task->func();
+		current_task = 0;
+
+		lk.lock();
+		auto end = clock::now();
+		running.erase(deadline.second);
+		auto& s = task->stats;
+		++s.runs;
+		s.last_jitter = to_us(start - deadline.first);
+		s.max_jitter = std::max(s.max_jitter, s.last_jitter);
+		s.total_jitter += s.last_jitter;
+		s.jitter_histogram.add(s.last_jitter);
+		s.last_runtime = to_us(end - start);
+		s.max_runtime = std::max(s.max_runtime, s.last_runtime);
+		s.runtime_histogram.add(s.last_runtime);
+		if( tasks.count(deadline.second) )
+		{
+			auto next = deadline.first + task->period;
+			if( next <= end )
+			{
+				// skip the periods we missed rather than running back to back
+				auto missed = (end - next) / task->period + 1;
+				s.overruns += missed;
+				next += missed * task->period;
+			}
+			schedule(next, deadline.second);
+		}
+		cv.notify_all();
+	}
+}
@@ -0,0 +1,124 @@
+#include "startup.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+// as close to the process starting as we can get
+const Startup::clock::time_point process_start = Startup::clock::now();
+
+long long to_ms(Startup::clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+}
+}
+
+Startup::~Startup()
+{
+	stop();
+}
+
+Startup& Startup::global()
+{
+	static Startup startup;
+	return startup;
+}
+
+Startup::Phase& Startup::phase(const std::string& name, clock::time_point now)
+{
+	auto it = std::find_if(phases.begin(), phases.end(), [&](const Phase& p){return p.name == name;});
+	if( it != phases.end() )
+		return *it;
+	phases.push_back({name, now - process_start, clock::duration::zero(), 0});
+	return phases.back();
+}
+
+void Startup::begin(const std::string& name)
+{
+	std::lock_guard<std::mutex> g{mut};
+	++phase(name, clock::now()).pending;
+}
+
+void Startup::end(const std::string& name)
+{
+	auto now = clock::now();
+	std::lock_guard<std::mutex> g{mut};
+	auto& p = phase(name, now);
+	p.took = now - process_start - p.start;
+	--p.pending;
+	logReady();
+}
+
+void Startup::logReady()
+{
+	if( logged_ready or not serving )
+		return;
+	if( std::any_of(phases.begin(), phases.end(), [](const Phase& p){return p.pending > 0;}) )
+		return;
+	logged_ready = true;
+	std::cerr << "startup: ready after " << to_ms(clock::now() - process_start) << " ms";
+	for(std::size_t i = 0; i < phases.size(); ++i)
+		std::cerr << (i ? ", " : "; ") << phases[i].name << " " << to_ms(phases[i].took) << " ms";
+	std::cerr << std::endl;
+}
+
+void Startup::background(const std::string& name, std::function<void()> f)
+{
+	std::lock_guard<std::mutex> g{mut};
+	++phase(name, clock::now()).pending;
+	threads.emplace_back([this, name, f=std::move(f), start=thread_start]{
+			if( start )
+				start();
+			f();
+			end(name);
+		});
+}
+
+void Startup::onThreadStart(std::function<void()> f)
+{
+	std::lock_guard<std::mutex> g{mut};
+	thread_start = std::move(f);
+}
+
+bool Startup::retry(clock::duration period, clock::duration timeout, const std::function<bool()>& attempt)
+{
+	auto give_up = clock::now() + timeout;
+	while( not attempt() )
+	{
+		std::unique_lock<std::mutex> lk{mut};
+		if( clock::now() >= give_up or cv.wait_until(lk, std::min(clock::now() + period, give_up), [this]{return stopping;}) )
+			return false;
+	}
+	return true;
+}
+
+void Startup::markServing()
+{
+	std::lock_guard<std::mutex> g{mut};
+	serving = true;
+	logReady();
+}
+
+bool Startup::ready()
+{
+	std::lock_guard<std::mutex> g{mut};
+	return logged_ready;
+}
+
+std::vector<Startup::Phase> Startup::getPhases()
+{
+	std::lock_guard<std::mutex> g{mut};
+	return phases;
+}
+
+void Startup::stop()
+{
+	std::vector<std::thread> running;
+	{
+		std::lock_guard<std::mutex> g{mut};
+		stopping = true;
+		running.swap(threads);
+	}
+	cv.notify_all();
+	for(auto&& t : running)
+		t.join();
+}
@@ -0,0 +1,269 @@
+#include "telemetry_log.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+	record: u32 payload length, u32 crc32 of payload, payload
+	payload: u8 type, u32 time, f64 value, key bytes
+*/
+namespace {
+constexpr std::size_t HeaderSize = 2 * sizeof(std::uint32_t);
+constexpr std::size_t FixedPayloadSize = sizeof(std::uint8_t) + sizeof(std::uint32_t) + sizeof(double);
+
+template<class T>
+void put(std::string& out, T v)
+{
+	out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+template<class T>
+T get(const char* in)
+{
+	T v;
+	std::memcpy(&v, in, sizeof(v));
+	return v;
+}
+
+void putRecord(std::string& out, TelemetryLog::RecordType type, const std::string& key, std::size_t time, double value)
+{
+	std::string payload;
+	payload.reserve(FixedPayloadSize + key.size());
+	put<std::uint8_t>(payload, type);
+	put<std::uint32_t>(payload, time);
+	put<double>(payload, value);
+	payload += key;
+	put<std::uint32_t>(out, payload.size());
+	put<std::uint32_t>(out, crc32(0, reinterpret_cast<const Bytef*>(payload.data()), payload.size()));
+	out += payload;
+}
+
+std::vector<std::filesystem::path> segments(const std::filesystem::path& dir)
+{
+	std::vector<std::filesystem::path> ret;
+	std::error_code ec;
+	for(auto&& entry : std::filesystem::directory_iterator{dir, ec})
+	{
+		auto stem = entry.path().stem().string();
+		if( entry.path().extension() == ".log" and not stem.empty() and stem.find_first_not_of("0123456789") == std::string::npos )
+			ret.push_back(entry.path());
+	}
+	// names are zero padded, so this is numeric order
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+}
+
+TelemetryLog::TelemetryLog(std::filesystem::path dir, std::size_t segment_bytes, std::size_t max_segments, unsigned ms_flush) :
+	dir(std::move(dir)),
+	segment_bytes(segment_bytes),
+	max_segments(std::max<std::size_t>(max_segments, 1))
+{
+	std::error_code ec;
+	std::filesystem::create_directories(this->dir, ec);
+	replay();
+	flush_task = std::make_unique<PeriodicTask>("telemetry_flush", [this](){flush();}, ms_flush, Scheduler::io());
+}
+
+TelemetryLog::~TelemetryLog()
+{
+	flush_task.reset();
+	flush();
+	if( fd >= 0 )
+		close(fd);
+}
+
+void TelemetryLog::replay()
+{
+	for(auto&& seg : segments(dir))
+	{
+		replaySegment(seg);
+		next_segment = std::max<std::uint64_t>(next_segment, std::stoull(seg.stem().string()) + 1);
+		// drop what the sensors' histories would drop anyway, so at most one
+		// segment more than that is held at a time
+		for(auto&& r : restored_samples)
+		{
+			auto& samples = r.second;
+			if( samples.empty() or samples.back().time < TempHistory::DefaultSpanSeconds )
+				continue;
+			auto cutoff = samples.back().time - TempHistory::DefaultSpanSeconds;
+			samples.erase(samples.begin(), std::find_if(samples.begin(), samples.end(), [&](const TempSample& s){return s.time >= cutoff;}));
+		}
+	}
+}
+
+void TelemetryLog::replaySegment(const std::filesystem::path& file)
+{
+	int in = open(file.c_str(), O_RDONLY);
+	if( in < 0 )
+		return;
+	struct stat st;
+	if( fstat(in, &st) != 0 or st.st_size == 0 )
+	{
+		close(in);
+		return;
+	}
+	std::size_t size = st.st_size;
+	void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, in, 0);
+	close(in);
+	if( map == MAP_FAILED )
+		return;
+	const char* data = static_cast<const char*>(map);
+	std::size_t pos = 0;
+	while( pos + HeaderSize <= size )
+	{
+		auto length = get<std::uint32_t>(data + pos);
+		auto crc = get<std::uint32_t>(data + pos + sizeof(std::uint32_t));
+		const char* payload = data + pos + HeaderSize;
+		// a torn or corrupt record ends the segment; nothing after it was synced
+		if( length < FixedPayloadSize or length > size - pos - HeaderSize )
+			break;
+		if( crc32(0, reinterpret_cast<const Bytef*>(payload), length) != crc )
+			break;
+		auto type = get<std::uint8_t>(payload);
+		auto time = get<std::uint32_t>(payload + sizeof(std::uint8_t));
+		auto value = get<double>(payload + sizeof(std::uint8_t) + sizeof(std::uint32_t));
+		std::string key(payload + FixedPayloadSize, length - FixedPayloadSize);
+		if( type == Sample )
+			restored_samples[key].push_back({time, value});
+		else if( type == Value )
+			restored_values[key] = value;
+		pos += HeaderSize + length;
+	}
+	munmap(map, size);
+}
+
+void TelemetryLog::openSegment()
+{
+	if( fd >= 0 )
+		close(fd);
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llu.log", static_cast<unsigned long long>(next_segment++));
+	fd = open((dir / name).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	segment_size = 0;
+	if( fd < 0 )
+	{
+		std::cerr << "telemetry: cant open " << (dir / name) << std::endl;
+		return;
+	}
+	auto segs = segments(dir);
+	for(std::size_t i = 0; i + max_segments < segs.size(); ++i)
+	{
+		std::error_code ec;
+		std::filesystem::remove(segs[i], ec);
+	}
+}
+
+void TelemetryLog::append(RecordType type, const std::string& key, std::size_t time, double value)
+{
+	std::lock_guard<std::mutex> g{pending_mut};
+	putRecord(pending, type, key, time, value);
+	if( type == Value )
+		current[key] = value;
+}
+
+void TelemetryLog::keep(const std::string& key, double value)
+{
+	std::lock_guard<std::mutex> g{pending_mut};
+	current[key] = value;
+}
+
+void TelemetryLog::flush()
+{
+	// a new segment every run, and after a failed write, so we never append after a torn tail
+	bool fresh = fd < 0 or segment_size >= segment_bytes;
+	std::string batch;
+	std::string head;
+	{
+		std::lock_guard<std::mutex> g{pending_mut};
+		batch.swap(pending);
+		if( fresh and not batch.empty() )
+		{
+			auto now = time_in_seconds();
+			for(auto&& v : current)
+				putRecord(head, Value, v.first, now, v.second);
+		}
+	}
+	if( batch.empty() )
+		return;
+	if( fresh )
+	{
+		openSegment();
+		batch.insert(0, head);
+	}
+	if( fd < 0 )
+		return;
+	std::size_t written = 0;
+	while( written < batch.size() )
+	{
+		auto ret = write(fd, batch.data() + written, batch.size() - written);
+		if( ret <= 0 )
+		{
+			std::cerr << "telemetry: write failed, dropping " << batch.size() - written << " bytes" << std::endl;
+			close(fd);
+			fd = -1;
+			return;
+		}
+		written += ret;
+	}
+	segment_size += written;
+	if( fdatasync(fd) != 0 )
+	{
+		std::cerr << "telemetry: sync failed, starting a new segment" << std::endl;
+		close(fd);
+		fd = -1;
+	}
+}
+
+std::vector<TempSample> TelemetryLog::takeRestoredSamples(const std::string& key)
+{
+	std::vector<TempSample> ret;
+	auto it = restored_samples.find(key);
+	if( it != restored_samples.end() )
+	{
+		ret = std::move(it->second);
+		restored_samples.erase(it);
+	}
+	return ret;
+}
+
+bool TelemetryLog::takeRestoredValue(const std::string& key, double& value)
+{
+	auto it = restored_values.find(key);
+	if( it == restored_values.end() )
+		return false;
+	value = it->second;
+	restored_values.erase(it);
+	return true;
+}
+
+void attachTelemetry(TempSensor& t, TelemetryLog& log, std::string keyPrefix)
+{
+	auto key = keyPrefix+"/"+t.getName();
+	t.restore(log.takeRestoredSamples(key));
+	t.onSample([&log, key](const TempSample& s) {
+			log.append(TelemetryLog::Sample, key, s.time, s.temp);
+		});
+}
+
+void attachTelemetry(HeaterController& h, TelemetryLog& log, std::string keyPrefix)
+{
+	auto key = keyPrefix+"/"+h.getName();
+	PIDController::Gains g;
+	if( log.takeRestoredValue(key+"/kp", g.kp) and log.takeRestoredValue(key+"/ki", g.ki) and log.takeRestoredValue(key+"/kd", g.kd) and HeaterController::validGains(g) )
+		h.setGains(g);
+	g = h.getGains();
+	log.keep(key+"/kp", g.kp);
+	log.keep(key+"/ki", g.ki);
+	log.keep(key+"/kd", g.kd);
+	h.onGainsChange([&log, key](PIDController::Gains g) {
+			auto now = time_in_seconds();
+			log.append(TelemetryLog::Value, key+"/kp", now, g.kp);
+			log.append(TelemetryLog::Value, key+"/ki", now, g.ki);
+			log.append(TelemetryLog::Value, key+"/kd", now, g.kd);
+		});
+}
@@ -0,0 +1,140 @@
+#include "temp_history.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+TempHistory::TempHistory(std::size_t raw_capacity, std::size_t ten_sec_capacity, std::size_t minute_capacity) :
+	raw(raw_capacity),
+	tiers{Ring<RollupEntry>(ten_sec_capacity), Ring<RollupEntry>(minute_capacity)}
+{}
+
+std::int16_t TempHistory::quantize(double temp)
+{
+	constexpr double lo = std::numeric_limits<std::int16_t>::min();
+	constexpr double hi = std::numeric_limits<std::int16_t>::max();
+	return static_cast<std::int16_t>(std::clamp(std::round(temp * 100.0), lo, hi));
+}
+
+double TempHistory::dequantize(std::int16_t q)
+{
+	return q / 100.0;
+}
+
+void TempHistory::append(std::size_t time, double temp)
+{
+	auto t = std::max(static_cast<std::uint32_t>(time), last_time);
+	last_time = t;
+	auto q = quantize(temp);
+	auto v = version.load(std::memory_order_relaxed);
+	version.store(v+1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	raw.push({t, q});
+	for(int tier = 0; tier < NumTiers; ++tier)
+	{
+		auto& a = accum[tier];
+		auto bucket = t / TierSeconds[tier];
+		if( a.active and a.bucket != bucket )
+		{
+			tiers[tier].push({a.bucket * TierSeconds[tier], a.min, static_cast<std::int16_t>(a.sum / a.count), a.max});
+			a.active = false;
+		}
+		if( not a.active )
+		{
+			a = Accumulator{};
+			a.active = true;
+			a.bucket = bucket;
+			a.min = a.max = q;
+		}
+		a.sum += q;
+		++a.count;
+		a.min = std::min(a.min, q);
+		a.max = std::max(a.max, q);
+	}
+	version.store(v+2, std::memory_order_release);
+}
+
+bool TempHistory::latest(TempSample& out) const
+{
+	return read([&]{
+			if( raw.empty() )
+				return false;
+			out = decode(raw.back());
+			return true;
+		});
+}
+
+template<class Out, class Entry>
+std::size_t TempHistory::copyRange(const Ring<Entry>& ring, std::size_t from, std::size_t max, std::vector<Out>& out) const
+{
+	out.reserve(max);
+	return read([&]{
+			out.clear();
+			auto first = std::max(from, ring.first());
+			auto last = std::min(ring.size(), first+max);
+			for(auto i = first; i < last; ++i)
+				out.push_back(decode(ring.at(i)));
+			return first;
+		});
+}
+
+std::size_t TempHistory::samples(std::size_t from, std::size_t max, std::vector<TempSample>& out) const
+{
+	return copyRange(raw, from, max, out);
+}
+
+std::size_t TempHistory::rollups(Tier t, std::size_t from, std::size_t max, std::vector<TempRollup>& out) const
+{
+	return copyRange(tiers[t], from, max, out);
+}
+
+template<class Entry, class Temp>
+void TempHistory::appendRange(const Ring<Entry>& ring, std::uint32_t from, std::uint64_t before, Temp temp, Series& out)
+{
+	// times only go up, so binary search for the first entry at or after from
+	auto lo = ring.first();
+	auto hi = ring.size();
+	while( lo < hi )
+	{
+		auto mid = lo + (hi - lo) / 2;
+		if( ring.at(mid).time < from )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for(auto i = lo; i < ring.size(); ++i)
+	{
+		auto e = ring.at(i);
+		if( e.time >= before )
+			break;
+		out.time.push_back(e.time);
+		out.temp.push_back(temp(e));
+	}
+}
+
+std::size_t TempHistory::range(std::size_t from, std::size_t to, Series& out) const
+{
+	auto clamp32 = [](std::size_t v) -> std::uint32_t {return std::min<std::size_t>(v, std::numeric_limits<std::uint32_t>::max());};
+	auto start = clamp32(from);
+	std::uint64_t end = std::uint64_t{clamp32(to)} + 1;
+	return read([&]{
+			out.time.clear();
+			out.temp.clear();
+			// each tier only fills in the time before the oldest entry of the finer ones
+			auto raw_begin = raw.empty() ? end : std::min<std::uint64_t>(end, raw.at(raw.first()).time);
+			auto& ten = tiers[TenSeconds];
+			auto ten_begin = ten.empty() ? raw_begin : std::min<std::uint64_t>(raw_begin, ten.at(ten.first()).time);
+			auto avg = [](const RollupEntry& e) {return e.avg;};
+			appendRange(tiers[OneMinute], start, ten_begin, avg, out);
+			appendRange(ten, start, raw_begin, avg, out);
+			appendRange(raw, start, end, [](const RawEntry& e) {return e.temp;}, out);
+			return raw.size();
+		});
+}
+
+std::size_t TempHistory::memoryBytes() const
+{
+	std::size_t ret = raw.memoryBytes();
+	for(auto&& r : tiers)
+		ret += r.memoryBytes();
+	return ret;
+}
@@ -0,0 +1,92 @@
+#include "temp_sensor_bus.h"
+#include "i2c.h"
+#include "metrics.h"
+#include <chrono>
+#include <vector>
+#include <wiringPi.h>
+
+TempSensorBus::TempSensorBus(unsigned ms_period, Scheduler& sched) :
+	convert_duration(MetricsRegistry::global().histogram("brewery_temp_sensor_convert_duration_seconds", "Time for a bulk conversion of every sensor.", 1e-6)),
+	update_task("temp_sensor_bus", [this](){update();}, ms_period, sched)
+{}
+
+TempSensorBus& TempSensorBus::global()
+{
+	static TempSensorBus bus;
+	return bus;
+}
+
+TempSensorBus::SubscriberId TempSensorBus::subscribe(int pin, Callback callback)
+{
+	std::lock_guard<std::mutex> g{mut};
+	auto id = next_id++;
+	subscribers[id] = {pin, std::move(callback)};
+	if( not pin_metrics.count(pin) )
+	{
+		auto& metrics = MetricsRegistry::global();
+		MetricsRegistry::Labels labels{{"pin", std::to_string(pin)}};
+		pin_metrics[pin] = {
+			&metrics.counter("brewery_temp_sensor_read_failures_total", "Sensor reads that gave no temperature, after any fallback.", labels),
+			&metrics.counter("brewery_temp_sensor_fallback_reads_total", "Sensor reads done through wiringPi because a direct read wasnt possible.", labels),
+			&metrics.histogram("brewery_temp_sensor_read_duration_seconds", "Time to read one sensor.", 1e-6, labels),
+		};
+	}
+	return id;
+}
+
+void TempSensorBus::unsubscribe(SubscriberId id)
+{
+	std::lock_guard<std::mutex> g{mut};
+	subscribers.erase(id);
+}
+
+void TempSensorBus::update()
+{
+	std::map<int, PinMetrics> pins;
+	{
+		std::lock_guard<std::mutex> g{mut};
+		for(auto&& s : subscribers)
+			pins.emplace(s.second.first, pin_metrics.at(s.second.first));
+	}
+	if( pins.empty() )
+		return;
+
+	using clock = std::chrono::steady_clock;
+	// a 12 bit conversion takes 750ms
+	auto start = clock::now();
+	bool bulk = i2c_bulk_convert(1000);
+	convert_duration.observe(clock::now() - start);
+	std::vector<std::pair<int, double>> readings;
+	for(auto&& [pin, metrics] : pins)
+	{
+		// still waiting for its device at startup; wiringPi has nothing on the pin to read
+		if( not isI2CDeviceMapped(pin) )
+			continue;
+		start = clock::now();
+		auto device = getI2CDeviceForPin(pin);
+		double celsius = 0;
+		bool ok = bulk and read_i2c_temp_celsius(device, celsius);
+		if( not ok )
+		{
+			metrics.fallbacks->add();
+			// ds18b20 node reads in tenths of a degree, and -9999 when the CRC check fails
+			int raw = analogRead(pin);
+			ok = raw != -9999;
+			celsius = ok ? raw / 10.0 : 0;
+		}
+		metrics.read_duration->observe(clock::now() - start);
+		// once per read, whichever way it went
+		I2CInventory::global().recordRead(device, ok, celsius);
+		if( ok )
+			readings.push_back({pin, celsius});
+		else
+			metrics.failures->add();
+	}
+
+	// callbacks run under the lock so unsubscribe cant return while one is in flight
+	std::lock_guard<std::mutex> g{mut};
+	for(auto&& r : readings)
+		for(auto&& s : subscribers)
+			if( s.second.first == r.first )
+				s.second.second(r.second * 1.8 + 32); // return in F
+}
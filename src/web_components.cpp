@@ -1,4 +1,6 @@
 #include "web_components.h"
+#include <charconv>
+#include <limits>
 
 std::string generateSelector(std::string name, std::vector<std::string> parent)
 {
@@ -23,30 +25,79 @@ std::string generateLayout(TempSensor& t)
 	return "<div id=\"" + t.getName() + "\"></div>\n"
 		"<canvas id=\"" + t.getName() + "_graph\" style=\"width:100%;max-width:700px\"></canvas>\n";
 }
-void registerEndpoints(TempSensor& t, SimpleApp& app, std::string endpointPrefix)
-{
-	app.route_dynamic(endpointPrefix+"/"+t.getName()+"/status/latest",
-		[&](){
-			JSONWrapper ret;
-			ret.set("value", std::to_string(t.getTempF()));
-			return ret.dump();
-		});
-	app.route_dynamic(endpointPrefix+"/"+t.getName()+"/status/<int>",
-		[&](std::size_t last){
-			JSONWrapper ret;
-			auto hist = t.getHistory();
-			// dont send too many elements at the same time
-			auto max_history = std::min(hist.size(), last+120);
-
-			for(unsigned int i = last; i < max_history; ++i)
-			{
-				JSONWrapper v;
-				v.set("x", std::to_string(hist[i].first));
-				v.set("y", std::to_string(hist[i].second));
-				ret.set(i-last, v);
-			}
-			return ret.dump();
-		});
+void generateStatus(TempSensor& t, JSONWriter& w)
+{
+	w.beginObject().field("value", t.getTempF()).field("size", t.getHistory().size()).endObject();
+}
+namespace {
+// a JSON body for a request we cant act on
+int errorResponse(JSONWriter& w, int code, std::string_view message)
+{
+	w.beginObject().field("error", message).endObject();
+	return code;
+}
+int latestTempRoute(TempSensor& t, const RouteRequest&, JSONWriter& w)
+{
+	w.beginObject().field("value", t.getTempF()).endObject();
+	return 200;
+}
+int historyRoute(TempSensor& t, const RouteRequest& r, JSONWriter& w)
+{
+	auto param = [&](std::string name, std::size_t& v) {
+		auto s = r.req.url_params_get(name);
+		if( s.empty() )
+			return true;
+		auto end = s.data() + s.size();
+		auto res = std::from_chars(s.data(), end, v);
+		return res.ec == std::errc{} and res.ptr == end;
+	};
+	std::size_t from = 0, to = std::numeric_limits<std::size_t>::max();
+	if( not param("from", from) or not param("to", to) )
+		return errorResponse(w, 400, "from and to should be seconds");
+	generateHistory(t, from, to, w);
+	return 200;
+}
+int samplesRoute(TempSensor& t, const RouteRequest& r, JSONWriter& w)
+{
+	thread_local std::vector<TempSample> samples;
+	// dont send too many elements at the same time; samples older than the
+	// raw window have been rolled up, so this may start later than asked
+	auto first = t.getHistory().samples(r.index, 120, samples);
+
+	w.beginArray();
+	for(std::size_t i = 0; i < samples.size(); ++i)
+		w.beginObject().field("x", samples[i].time).field("y", samples[i].temp).field("i", first+i).endObject();
+	w.endArray();
+	return 200;
+}
+}
+void registerEndpoints(TempSensor& t, RouteTable& routes, std::string endpointPrefix)
+{
+	auto path = endpointPrefix+"/"+t.getName();
+	routes.add<Details::statusRoute<TempSensor>>(path+"/status", t);
+	routes.add<latestTempRoute>(path+"/status/latest", t);
+	routes.add<historyRoute>(path+"/history", t);
+	routes.addIndexed<samplesRoute>(path+"/status", t);
+}
+void generateHistory(TempSensor& t, std::size_t from, std::size_t to, JSONWriter& w)
+{
+	// reused between requests on the same thread so a backfill doesnt allocate per point
+	thread_local TempHistory::Series series;
+	auto next = t.getHistory().range(from, to, series);
+	// columnar: times as deltas from the previous point, temps as integers times scale
+	w.beginObject();
+	w.field("next", next);
+	w.field("scale", 0.01);
+	w.field("time", series.time.empty() ? 0 : series.time.front());
+	w.key("dtime").beginArray();
+	for(std::size_t i = 0; i < series.time.size(); ++i)
+		w.value(i ? series.time[i] - series.time[i-1] : 0);
+	w.endArray();
+	w.key("temp").beginArray();
+	for(auto temp : series.temp)
+		w.value(temp);
+	w.endArray();
+	w.endObject();
 }
 std::string generateUpdateJS(TempSensor& t, std::vector<std::string> parent)
 {
@@ -60,14 +111,22 @@ std::string generateLayout(Button& b)
 	return "<button id=\"" + b.getName() + "\">" + b.getName() + "</button>\n";
 }
 
-void registerEndpoints(Button& b, SimpleApp& app, std::string endpointPrefix)
+void generateStatus(Button& b, JSONWriter& w)
+{
+	generateStatus(static_cast<ReadableValue<int>&>(b), w);
+}
+
+namespace {
+int toggleRoute(Button& b, const RouteRequest&, JSONWriter&)
 {
-	registerEndpoints(static_cast<ReadableValue<int>&>(b), app, endpointPrefix);
-	app.route_dynamic(endpointPrefix+"/"+b.getName()+"/toggle",
-			[&](){
-				b.set(!b.get());
-				return std::string{};
-			});
+	b.set(!b.get());
+	return 200;
+}
+}
+void registerEndpoints(Button& b, RouteTable& routes, std::string endpointPrefix)
+{
+	registerEndpoints(static_cast<ReadableValue<int>&>(b), routes, endpointPrefix);
+	routes.add<toggleRoute>(endpointPrefix+"/"+b.getName()+"/toggle", b);
 }
 
 std::string generateUpdateJS(Button& b, std::vector<std::string> parent)
@@ -77,18 +136,152 @@ std::string generateUpdateJS(Button& b, std::vector<std::string> parent)
 	return "registerButton('" + endpoint + "', '" + selector + "');\n";
 }
 
+void generateStatus(FlowSensor& f, JSONWriter& w)
+{
+	w.beginObject().field("value", f.get()).field("rate", f.getRate().get()).endObject();
+}
+
+void registerEndpoints(FlowSensor& f, RouteTable& routes, std::string endpointPrefix)
+{
+	routes.add<Details::statusRoute<FlowSensor>>(endpointPrefix+"/"+f.getName()+"/status", f);
+	routes.add<Details::statusRoute<ReadableValue<double>>>(endpointPrefix+"/"+f.getName()+"/rate", f.getRate());
+}
+
+std::string generateUpdateJS(FlowSensor& f, std::vector<std::string> parent)
+{
+	std::string selector = generateSelector(f.getName(), parent);
+	std::string endpoint = generateEndpoint(f.getName(), parent);
+	return "registerFlow('" + endpoint + "', '" + selector + "');\n";
+}
+
+void generateStatus(HeaterController& h, JSONWriter& w)
+{
+	auto s = h.getStatus();
+	w.beginObject();
+	w.field("mode", HeaterController::modeName(s.mode));
+	w.field("stale", s.stale);
+	w.field("setpoint", s.setpoint);
+	w.field("temp", s.temp);
+	w.field("duty", s.duty);
+	w.field("p", s.terms.p);
+	w.field("i", s.terms.i);
+	w.field("d", s.terms.d);
+	w.field("kp", s.gains.kp);
+	w.field("ki", s.gains.ki);
+	w.field("kd", s.gains.kd);
+	w.field("autotune", HeaterController::autotuneStateName(s.autotune));
+	w.endObject();
+}
+
+namespace {
+int setModeRoute(HeaterController& h, const RouteRequest& r, JSONWriter& w)
+{
+	HeaterController::Mode m;
+	if( not HeaterController::parseMode(r.req.url_params_get("value"), m) )
+		return errorResponse(w, 400, "unknown mode");
+	h.setMode(m);
+	return 200;
+}
+// any gain left out keeps its current value
+int setGainsRoute(HeaterController& h, const RouteRequest& r, JSONWriter& w)
+{
+	auto g = h.getGains();
+	auto param = [&](std::string name, double& v) {
+		auto s = r.req.url_params_get(name);
+		if( s.empty() )
+			return true;
+		std::stringstream ss(s);
+		char junk;
+		return ss >> v and not (ss >> junk);
+	};
+	if( not param("kp", g.kp) or not param("ki", g.ki) or not param("kd", g.kd) or not HeaterController::validGains(g) )
+		return errorResponse(w, 400, "gains should be finite and not negative");
+	h.setGains(g);
+	return 200;
+}
+}
+void registerEndpoints(HeaterController& h, RouteTable& routes, std::string endpointPrefix)
+{
+	routes.add<Details::statusRoute<HeaterController>>(endpointPrefix+"/"+h.getName()+"/status", h);
+	routes.add<setModeRoute>(endpointPrefix+"/"+h.getName()+"/set_mode", h);
+	routes.add<setGainsRoute>(endpointPrefix+"/"+h.getName()+"/set_gains", h);
+}
+
+void generateStatus(MashSchedule& m, JSONWriter& w)
+{
+	auto s = m.getStatus();
+	w.beginObject();
+	w.field("state", MashSchedule::stateName(s.state));
+	w.field("paused", s.paused);
+	w.field("step", s.step);
+	w.field("setpoint", s.setpoint);
+	w.field("temp", s.temp);
+	w.field("hold_left", s.hold_left);
+	w.key("steps").beginArray();
+	for(auto&& step : s.steps)
+		w.beginObject().field("temp", step.temp).field("hold", step.hold).field("ramp", step.ramp).endObject();
+	w.endArray();
+	w.endObject();
+}
+
+namespace {
+int setStepsRoute(MashSchedule& m, const RouteRequest& r, JSONWriter& w)
+{
+	std::vector<MashSchedule::Step> steps;
+	if( not MashSchedule::parseSteps(r.req.url_params_get("steps"), steps) )
+		return errorResponse(w, 400, "steps should be temp:minutes[:ramp],...");
+	if( not m.reachable(steps) )
+		return errorResponse(w, 400, "a step is hotter or colder than the heater can be set to");
+	if( not m.setSteps(std::move(steps)) )
+		return errorResponse(w, 409, "stop the schedule first");
+	return 200;
+}
+template<bool (MashSchedule::*Command)()>
+int commandRoute(MashSchedule& m, const RouteRequest&, JSONWriter& w)
+{
+	if( (m.*Command)() )
+		return 200;
+	return errorResponse(w, 409, "not possible in the current state");
+}
+}
+void registerEndpoints(MashSchedule& m, RouteTable& routes, std::string endpointPrefix)
+{
+	auto prefix = endpointPrefix+"/"+m.getName();
+	routes.add<Details::statusRoute<MashSchedule>>(prefix+"/status", m);
+	routes.add<setStepsRoute>(prefix+"/set_steps", m);
+	routes.add<commandRoute<&MashSchedule::start>>(prefix+"/start", m);
+	routes.add<commandRoute<&MashSchedule::pause>>(prefix+"/pause", m);
+	routes.add<commandRoute<&MashSchedule::resume>>(prefix+"/resume", m);
+	routes.add<commandRoute<&MashSchedule::skip>>(prefix+"/skip", m);
+	routes.add<commandRoute<&MashSchedule::stop>>(prefix+"/stop", m);
+}
+
+void pushStatus(MashSchedule& m, SimpleApp& app, std::string endpointPrefix)
+{
+	thread_local std::string buffer;
+	buffer.clear();
+	auto endpoint = endpointPrefix+"/"+m.getName();
+	JSONWriter w(buffer);
+	w.beginObject().field("endpoint", endpoint).key("status");
+	generateStatus(m, w);
+	w.endObject();
+	app.push(endpoint, buffer);
+}
+
 template<class T>
 std::string generateLayout(ReadableValue<T>& r)
 {
 	return "<div id=\"" + r.getName() + "\"></div>\n";
 }
 template<class T>
-void registerEndpoints(ReadableValue<T>& r, SimpleApp& app, std::string endpointPrefix)
+void generateStatus(ReadableValue<T>& r, JSONWriter& w)
 {
-	app.route_dynamic(endpointPrefix+"/"+r.getName()+"/status",
-			[&](){
-				return std::to_string(r.get());
-			});
+	w.value(r.get());
+}
+template<class T>
+void registerEndpoints(ReadableValue<T>& r, RouteTable& routes, std::string endpointPrefix)
+{
+	routes.add<Details::statusRoute<ReadableValue<T>>>(endpointPrefix+"/"+r.getName()+"/status", r);
 }
 template<class T>
 std::string generateUpdateJS(ReadableValue<T>& r, std::vector<std::string> parent)
@@ -109,18 +302,29 @@ std::string generateLayout(TargetValue<T>& t)
 
 
 template<class T>
-void registerEndpoints(TargetValue<T>& t, SimpleApp& app, std::string endpointPrefix)
+void generateStatus(TargetValue<T>& t, JSONWriter& w)
+{
+	generateStatus(static_cast<ReadableValue<T>&>(t), w);
+}
+
+namespace {
+template<class T>
+int setTargetRoute(TargetValue<T>& t, const RouteRequest& r, JSONWriter&)
+{
+	std::stringstream ss;
+	ss << r.req.url_params_get("value");
+	T v;
+	ss >> v;
+	t.set(v);
+	return 200;
+}
+}
+
+template<class T>
+void registerEndpoints(TargetValue<T>& t, RouteTable& routes, std::string endpointPrefix)
 {
-	registerEndpoints(static_cast<WriteableValue<T>&>(t), app, endpointPrefix);
-	app.route_dynamic(endpointPrefix+"/"+t.getName()+"/set_target",
-			[&](const CrowRequest& req){
-				std::stringstream ss;
-				ss << req.url_params_get("value");
-				T v;
-				ss >> v;
-				t.set(v);
-				return std::string{};
-			});
+	registerEndpoints(static_cast<WriteableValue<T>&>(t), routes, endpointPrefix);
+	routes.add<setTargetRoute<T>>(endpointPrefix+"/"+t.getName()+"/set_target", t);
 }
 
 template<class T>
@@ -134,7 +338,8 @@ std::string generateUpdateJS(TargetValue<T>& t, std::vector<std::string> parent)
 //explicit instantiate
 #define EXPLICIT_INSTANTIATE(PARAM, TEMPL_TYPE) \
 template std::string generateLayout<TEMPL_TYPE>(PARAM<TEMPL_TYPE>&); \
-template void registerEndpoints<TEMPL_TYPE>(PARAM<TEMPL_TYPE>&,SimpleApp&,std::string); \
+template void generateStatus<TEMPL_TYPE>(PARAM<TEMPL_TYPE>&,JSONWriter&); \
+template void registerEndpoints<TEMPL_TYPE>(PARAM<TEMPL_TYPE>&,RouteTable&,std::string); \
 template std::string generateUpdateJS<TEMPL_TYPE>(PARAM<TEMPL_TYPE>&,std::vector<std::string>);
 EXPLICIT_INSTANTIATE(ReadableValue, int)
 EXPLICIT_INSTANTIATE(ReadableValue, double)
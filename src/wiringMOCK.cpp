@@ -1,9 +1,12 @@
+#include "plant_sim.h"
+
+// off the Pi the pins drive a simulated brewery, see plant_sim.h
 extern "C" {
 void wiringPiSetup() {}
 void pinMode(int,int) {}
-void digitalWrite(int,int) {}
-int analogRead(int) {return 0;}
+void digitalWrite(int pin, int value) {PlantSim::global().digitalWrite(pin, value);}
+int analogRead(int pin) {return PlantSim::global().analogRead(pin);}
 void wiringPiISR(int,int,void(*)()) {}
-void wiringPiISR_data(int,int,void(*)(void*),void*) {}
-void ds18b20Setup(int, const char*) {}
+void wiringPiISR_data(int pin, int, void(*function)(void*), void* data) {PlantSim::global().registerIsr(pin, function, data);}
+int ds18b20Setup(int, const char*) {return 1;}
 }
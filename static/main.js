@@ -15,67 +15,133 @@ function countedJSON(endpoint, func) {
 		$("#downStatus").dialog("open");
 	}
 }
-function updateText(endpoint, selector) {
-	countedJSON(endpoint+"/status", function(data) {
-		const path = endpoint.split("/");
-		$(selector).html(path[path.length-1] + " : " + data);
-	});
+// aggregate status endpoints, each mapping widget endpoints under it to their update function
+var status_roots = {};
+var push_socket = null;
+function dispatchStatus(endpoint, data) {
+	for (e in status_roots[endpoint])
+	{
+		var value = data;
+		// a widget on the root itself gets the whole status
+		const path = e == endpoint ? [] : e.substring(endpoint.length+1).split("/");
+		for (p in path)
+			value = (value === undefined) ? undefined : value[path[p]];
+		if( value !== undefined )
+			status_roots[endpoint][e](value);
+	}
+}
+function connectPush() {
+	push_socket = new WebSocket((location.protocol == "https:" ? "wss://" : "ws://") + location.host + "/push");
+	push_socket.onmessage = function(event) {
+		var msg = JSON.parse(event.data);
+		if( msg.endpoint in status_roots )
+			dispatchStatus(msg.endpoint, msg.status);
+	};
+	push_socket.onclose = function() {
+		push_socket = null;
+		setTimeout(connectPush, 5000);
+	};
+}
+function subscribeStatus(endpoint) {
+	status_roots[endpoint] = {};
+	if( push_socket === null )
+		connectPush();
+	// the server pushes changes as they happen; only poll while the socket is down
+	setInterval(function(){
+		if( push_socket === null || push_socket.readyState != WebSocket.OPEN )
+			countedJSON(endpoint+"/status", function(data) { dispatchStatus(endpoint, data); });
+	}, 1000);
+}
+// feed func from an aggregate status poll if one covers endpoint, otherwise poll endpoint on its own
+function onStatus(endpoint, func, interval) {
+	for (root in status_roots)
+	{
+		if( endpoint == root || endpoint.startsWith(root+"/") )
+		{
+			status_roots[root][endpoint] = func;
+			return;
+		}
+	}
+	setInterval(function(){ countedJSON(endpoint+"/status", func); }, interval);
+}
+function showText(endpoint, selector, data) {
+	const path = endpoint.split("/");
+	$(selector).html(path[path.length-1] + " : " + data);
+}
+function showButton(selector, data) {
+	if( !$.isNumeric(data) || data == 0 )
+		$(selector).css('color','red');
+	else
+		$(selector).css('color','green');
 }
 function updateButton(endpoint, selector) {
-	countedJSON(endpoint+"/status", function(data) {
-		if( !$.isNumeric(data) || data == 0 )
-			$(selector).css('color','red');
-		else
-			$(selector).css('color','green');
-	});
+	countedJSON(endpoint+"/status", function(data) { showButton(selector, data); });
+}
+function showTargetValue(endpoint, selector, data) {
+	$(selector).prop("value", data);
+	const path = endpoint.split("/");
+	$(selector+"_label").html(path[path.length-1] + "_target : " + data);
+	$(selector+"_label").css('color','');
 }
 function updateTargetValue(endpoint, selector) {
-	countedJSON(endpoint+"/status", function(data) {
-		$(selector).prop("value", data);
-		const path = endpoint.split("/");
-		$(selector+"_label").html(path[path.length-1] + "_target : " + data);
-		$(selector+"_label").css('color','');
-	});
+	countedJSON(endpoint+"/status", function(data) { showTargetValue(endpoint, selector, data); });
 }
-function updateGraph(chart, endpoint, selectorText, selectorGraph) {
-	countedJSON(endpoint+"/status/latest", function(data) {
-		const path = endpoint.split("/");
-		$(selectorText).html(path[path.length-1] + " : " + data.value);
-	});
-	countedJSON(endpoint+"/status/"+(chart.data.labels.length-1), function(data) {
+function addGraphPoint(chart, time, temp) {
+	// time is in seconds since the epoch
+	chart.data.labels.push(new Date(time * 1000).toLocaleTimeString());
+	chart.data.datasets[0].data.push(temp);
+}
+function showGraph(chart, endpoint, selectorText, data) {
+	showText(endpoint, selectorText, data.value);
+	// only go back for the history when there are samples we havent seen
+	if( chart.loading || data.size <= chart.next_index )
+		return;
+	chart.loading = true;
+	if( chart.next_index == 0 )
+	{
+		// first time through, get everything the server still holds in one go
+		$.getJSON(endpoint+"/history", function(hist) {
+			var time = hist.time;
+			for (i in hist.dtime)
+			{
+				time += hist.dtime[i];
+				addGraphPoint(chart, time, Number((hist.temp[i] * hist.scale).toFixed(2)));
+			}
+			chart.next_index = hist.next;
+			chart.update();
+		}).always(function(){ chart.loading = false; });
+		return;
+	}
+	$.getJSON(endpoint+"/status/"+chart.next_index, function(data) {
 		for (e in data)
 		{
 			if( !data[e] )
 				continue;
-			var time = Number(data[e].x);
-			var hours = Math.floor(time / 3600);
-			time = time - hours * 3600;
-			var minutes = Math.floor(time / 60);
-			var seconds  = time - minutes * 60;
-			if( minutes < 10 )
-				minutes = "0" + minutes;
-			if( seconds < 10 )
-				seconds = "0" + seconds;
-			chart.data.labels.push(hours+":"+minutes+":"+seconds);
-			chart.data.datasets[0].data.push(data[e].y);
-			chart.update();
+			chart.next_index = Number(data[e].i) + 1;
+			addGraphPoint(chart, Number(data[e].x), data[e].y);
 		}
-	});
+		chart.update();
+	}).always(function(){ chart.loading = false; });
 }
 function registerText(endpoint, selector) {
-	setInterval(function(){ updateText(endpoint, selector); }, 1000);
+	onStatus(endpoint, function(data){ showText(endpoint, selector, data); }, 1000);
+}
+function registerFlow(endpoint, selector) {
+	onStatus(endpoint, function(data){
+		showText(endpoint, selector, Number(data.value).toFixed(2) + " gal @ " + Number(data.rate).toFixed(2) + " gpm");
+	}, 1000);
 }
 function registerButton(endpoint, selector) {
 	var updateFunc = function(){updateButton(endpoint, selector);};
 	$(selector).click(function(){$.get(endpoint + "/toggle"); setTimeout(updateFunc,100);});
-	setInterval(updateFunc, 1000);
+	onStatus(endpoint, function(data){ showButton(selector, data); }, 1000);
 }
 function registerTargetValue(endpoint, selector, MinValue, MaxValue) {
 	$(selector).prop('min', MinValue);
 	$(selector).prop('max', MaxValue);
 	$(selector).css('width', '100%');
 	var updateFunc = function(){updateTargetValue(endpoint,selector);};
-	setInterval(updateFunc, 1000);
+	onStatus(endpoint, function(data){ showTargetValue(endpoint, selector, data); }, 1000);
 	const path = endpoint.split("/");
 	// input is when we are moving the slider around but havent actually finalized anything
 	var inputFunc = function(){
@@ -113,28 +179,36 @@ function registerGraph(endpoint, selectorText, selectorGraph) {
 				}
 			}
 		});
-	setInterval(function(){ updateGraph(chart, endpoint, selectorText, selectorGraph); }, 2000);
+	chart.next_index = 0;
+	chart.loading = false;
+	onStatus(endpoint, function(data){ showGraph(chart, endpoint, selectorText, data); }, 2000);
 }
 function registerSelect(listEndpoint, selectorText, deviceEndpoint) {
+	// the server only sends the list again once its version changes
+	var version = "";
 	var updateFunc = function(){
-		countedJSON(listEndpoint, function(data) {
-			var options = [];
-			for( e in data)
+		countedJSON(listEndpoint + "?version=" + version, function(data) {
+			if( data.devices !== undefined )
 			{
-				options.push("<option value='" + data[e].value + "'>" + data[e].value + "</option>");
+				version = data.version;
+				var options = [];
+				for( e in data.devices)
+				{
+					options.push("<option value='" + data.devices[e].value + "'>" + data.devices[e].value + "</option>");
+				}
+				$(selectorText+" option").each(function(index,option) {$(option).remove();});
+				$(selectorText).append(options.join("")).selectmenu();
 			}
-			$(selectorText+" option").each(function(index,option) {$(option).remove();});
-			$(selectorText).append(options.join("")).selectmenu();
 			// set the currently active device as selected
 			countedJSON(deviceEndpoint+"/get", function(curdevice){
 				$(selectorText).val(curdevice.value);
 				$(selectorText).selectmenu("refresh");
 			});
-			// when a new device is selected, send an update message to the server
-			$(selectorText).on("selectmenuchange", function(event,ui){
-				countedJSON(deviceEndpoint+"/set/"+$(selectorText).val(), function(_ignore){});
-			});
 		});
 	};
+	// when a new device is selected, send an update message to the server
+	$(selectorText).on("selectmenuchange", function(event,ui){
+		countedJSON(deviceEndpoint+"/set/"+$(selectorText).val(), function(_ignore){});
+	});
 	setInterval(updateFunc, 5000);
 }
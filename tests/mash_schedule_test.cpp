@@ -0,0 +1,237 @@
+#include "mash_schedule.h"
+#include "clock.h"
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+	Runs MashSchedule against a frozen clock and a history the test fills in,
+	checking when it ramps, holds, pauses and moves on. Exits non zero if any
+	check fails.
+*/
+namespace {
+int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+void check(bool ok, const char* what, int line)
+{
+	if( ok )
+		return;
+	++failures;
+	std::cerr << "mash_schedule_test.cpp:" << line << ": failed: " << what << std::endl;
+}
+
+// the schedule's world: time stands still until moved, and the vessel reads what it is told
+class Rig {
+	Clock::time_point start = Clock::now();
+	std::optional<Clock::Frozen> frozen;
+public:
+	TempHistory history;
+	Heater heater{"heater", 0, 212, 0};
+	MashSchedule schedule{"mash", heater, history};
+
+	Rig()
+	{
+		frozen.emplace(start);
+	}
+	// seconds after the rig was made
+	void at(std::size_t seconds)
+	{
+		frozen.reset();
+		frozen.emplace(start + std::chrono::seconds(seconds));
+	}
+	void reads(double temp)
+	{
+		history.append(time_in_seconds(), temp);
+		schedule.update();
+	}
+	MashSchedule::Status status() {return schedule.getStatus();}
+};
+
+void parse()
+{
+	std::vector<MashSchedule::Step> steps;
+	CHECK(MashSchedule::parseSteps("152:60,168:10:1.5", steps));
+	CHECK(steps.size() == 2);
+	CHECK(steps[0].temp == 152 and steps[0].hold == 3600 and steps[0].ramp == 0);
+	CHECK(steps[1].temp == 168 and steps[1].hold == 600 and steps[1].ramp == 1.5);
+	CHECK(MashSchedule::parseSteps("150:0.5", steps) and steps.size() == 1 and steps[0].hold == 30);
+	CHECK(MashSchedule::parseSteps("", steps) and steps.empty());
+
+	steps = {{150, 60, 0}};
+	for(auto bad : {"152", "152:", "152:60:", "152:60:1:2", "152;60", "152:-1", "152:60:-1", "abc:1", "nan:1", "152:inf", "152:60,x"})
+		CHECK(not MashSchedule::parseSteps(bad, steps));
+	// a bad list leaves the steps alone
+	CHECK(steps.size() == 1 and steps[0].temp == 150);
+}
+
+void reachable()
+{
+	Rig r;
+	CHECK(r.schedule.reachable({{0, 60, 0}, {150, 60, 0}, {212, 0, 0}}));
+	CHECK(not r.schedule.reachable({{150, 60, 0}, {213, 60, 0}}));
+	CHECK(not r.schedule.reachable({{-1, 60, 0}}));
+}
+
+void rampThenHold()
+{
+	Rig r;
+	r.schedule.setSteps({{150, 60, 10}});
+	r.reads(100);
+	CHECK(r.schedule.start());
+	r.reads(100);
+	CHECK(r.status().state == MashSchedule::Ramping);
+	CHECK(r.heater.get() == 100);
+
+	r.at(60);
+	r.reads(102);
+	CHECK(r.heater.get() == 110);
+	CHECK(r.status().hold_left == 60);
+
+	// the ramp stops at the step's temperature
+	r.at(600);
+	r.reads(140);
+	CHECK(r.status().state == MashSchedule::Ramping);
+	CHECK(r.heater.get() == 150);
+
+	// the hold starts once in the band
+	r.at(700);
+	r.reads(149.5);
+	CHECK(r.status().state == MashSchedule::Holding);
+	CHECK(r.status().hold_left == 60);
+
+	r.at(759);
+	r.reads(150);
+	CHECK(r.status().state == MashSchedule::Holding);
+	CHECK(r.status().hold_left == 1);
+
+	r.at(760);
+	r.reads(150);
+	CHECK(r.status().state == MashSchedule::Done);
+	CHECK(r.status().step == 1);
+	CHECK(r.heater.get() == 150);
+}
+
+void noTempNoHold()
+{
+	Rig r;
+	r.schedule.setSteps({{150, 60, 0}});
+	r.reads(150);
+	r.schedule.start();
+	// the last reading goes stale, so the hold waits
+	r.at(100);
+	r.schedule.update();
+	CHECK(r.status().state == MashSchedule::Ramping);
+	CHECK(r.heater.get() == 150);
+}
+
+void pauseAndResume()
+{
+	Rig r;
+	r.schedule.setSteps({{150, 60, 0}, {160, 0, 0}});
+	r.reads(150);
+	r.schedule.start();
+	r.reads(150);
+	CHECK(r.status().state == MashSchedule::Holding);
+
+	r.at(20);
+	r.reads(150);
+	CHECK(r.schedule.pause());
+	CHECK(not r.schedule.pause());
+	CHECK(r.status().paused);
+	CHECK(r.status().hold_left == 40);
+
+	// nothing moves while paused
+	r.at(1000);
+	r.reads(150);
+	CHECK(r.status().state == MashSchedule::Holding);
+	CHECK(r.status().hold_left == 40);
+
+	CHECK(r.schedule.resume());
+	CHECK(not r.schedule.resume());
+	r.at(1039);
+	r.reads(150);
+	CHECK(r.status().state == MashSchedule::Holding);
+	CHECK(r.status().hold_left == 1);
+
+	r.at(1040);
+	r.reads(150);
+	CHECK(r.status().state == MashSchedule::Ramping);
+	CHECK(r.status().step == 1);
+	CHECK(r.heater.get() == 160);
+}
+
+void skipAndStop()
+{
+	Rig r;
+	r.schedule.setSteps({{150, 600, 0}, {160, 0, 0}, {170, 600, 0}});
+	r.reads(120);
+	CHECK(not r.schedule.skip());
+	r.schedule.start();
+	r.reads(120);
+	CHECK(r.schedule.skip());
+	CHECK(r.status().step == 1);
+	r.reads(120);
+	CHECK(r.heater.get() == 160);
+
+	// a step already at temp with no hold is passed straight through
+	r.at(10);
+	r.reads(160);
+	CHECK(r.status().step == 2);
+	CHECK(r.heater.get() == 170);
+
+	CHECK(not r.schedule.setSteps({}));
+	CHECK(r.schedule.stop());
+	CHECK(not r.schedule.stop());
+	CHECK(r.status().state == MashSchedule::Idle);
+	CHECK(r.schedule.setSteps({}));
+	CHECK(not r.schedule.start());
+}
+
+void setByHand()
+{
+	Rig r;
+	r.schedule.setSteps({{150, 0, 10}, {160, 60, 10}});
+	r.reads(100);
+	r.schedule.start();
+	r.reads(100);
+	CHECK(r.heater.get() == 100);
+
+	// the ramp leaves a hand set target alone for the rest of the step
+	r.heater.set(130);
+	r.at(60);
+	r.reads(105);
+	CHECK(r.heater.get() == 130);
+	r.at(120);
+	r.reads(110);
+	CHECK(r.heater.get() == 130);
+
+	// and picks up again at the next one
+	r.at(180);
+	r.reads(150);
+	CHECK(r.status().step == 1);
+	r.reads(150);
+	CHECK(r.heater.get() == 150);
+	r.at(240);
+	r.reads(151);
+	CHECK(r.heater.get() == 160);
+}
+}
+
+int main()
+{
+	parse();
+	reachable();
+	rampThenHold();
+	noTempNoHold();
+	pauseAndResume();
+	skipAndStop();
+	setByHand();
+	if( failures )
+		std::cerr << failures << " checks failed" << std::endl;
+	else
+		std::cout << "mash schedule: all checks passed" << std::endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,598 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+	Load generator and soak test for the web server. Starts run_brewery (a mock
+	build, so it needs no hardware), asks it for its routes, then has N clients
+	replay what static/main.js does with the push socket down, which is the worst
+	case: load the page and its assets, backfill every temperature graph, poll the
+	aggregate status every second, fetch new graph points as they appear and poll
+	the sensor list every 5 seconds.
+
+	Prints throughput, latency percentiles, errors and the server's CPU and RSS
+	every report interval and once more at the end.
+
+	build and run with `make loadtest`, or see --help
+*/
+
+namespace {
+using clock = std::chrono::steady_clock;
+
+struct Options {
+	std::string server;        // run_brewery to start; empty to use one already running
+	std::string template_dir = ".";
+	std::string host = "127.0.0.1";
+	unsigned port = 40180;
+	unsigned clients = 10;
+	unsigned duration = 60;    // seconds
+	unsigned report = 10;      // seconds
+	double sim_speed = 10;
+};
+
+/* HTTP */
+struct Response {
+	int code = 0;
+	std::string body;
+};
+
+class Connection {
+	std::string host;
+	unsigned port;
+	int fd = -1;
+	std::string buffer;
+
+	bool connect()
+	{
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if( fd < 0 )
+			return false;
+		timeval timeout{5, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+		if( ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 )
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	void close()
+	{
+		if( fd >= 0 )
+			::close(fd);
+		fd = -1;
+		buffer.clear();
+	}
+	// reads until buffer holds at least n bytes
+	bool fill(std::size_t n)
+	{
+		char tmp[16384];
+		while( buffer.size() < n )
+		{
+			auto got = recv(fd, tmp, sizeof(tmp), 0);
+			if( got <= 0 )
+				return false;
+			buffer.append(tmp, got);
+		}
+		return true;
+	}
+	bool readResponse(Response& res)
+	{
+		std::size_t header_end;
+		while( (header_end = buffer.find("\r\n\r\n")) == std::string::npos )
+			if( not fill(buffer.size() + 1) )
+				return false;
+		std::string headers = buffer.substr(0, header_end);
+		buffer.erase(0, header_end + 4);
+		if( std::sscanf(headers.c_str(), "HTTP/1.%*d %d", &res.code) != 1 )
+			return false;
+		std::size_t length = 0;
+		std::string lower = headers;
+		std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		auto cl = lower.find("content-length:");
+		if( cl != std::string::npos )
+			length = std::stoul(headers.substr(cl + 15));
+		if( not fill(length) )
+			return false;
+		res.body = buffer.substr(0, length);
+		buffer.erase(0, length);
+		if( lower.find("connection: close") != std::string::npos )
+			close();
+		return true;
+	}
+public:
+	Connection(std::string host, unsigned port) : host(host), port(port) {}
+	Connection(const Connection&)=delete;
+	~Connection() {close();}
+	bool get(const std::string& path, Response& res)
+	{
+		// a kept alive connection may have been dropped by the server; retry once on a fresh one
+		for(int attempt = 0; attempt < 2; ++attempt)
+		{
+			bool reused = fd >= 0;
+			if( not reused and not connect() )
+				return false;
+			std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nAccept-Encoding: gzip\r\n\r\n";
+			if( send(fd, req.data(), req.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(req.size()) and readResponse(res) )
+				return true;
+			close();
+			if( not reused )
+				return false;
+		}
+		return false;
+	}
+};
+
+/* Stats */
+struct Stats {
+	std::mutex mut;
+	std::vector<double> latencies_ms; // since the last report
+	std::vector<double> all_latencies_ms;
+	std::map<std::string, std::vector<double>> by_kind_ms;
+	std::map<std::string, std::size_t> errors;
+	std::size_t total_errors = 0;
+
+	void record(const std::string& kind, double ms)
+	{
+		std::lock_guard<std::mutex> g{mut};
+		latencies_ms.push_back(ms);
+		by_kind_ms[kind].push_back(ms);
+	}
+	void error(const std::string& what)
+	{
+		std::lock_guard<std::mutex> g{mut};
+		++errors[what];
+		++total_errors;
+	}
+};
+
+double percentile(std::vector<double>& v, double p)
+{
+	if( v.empty() )
+		return 0;
+	auto i = std::min(v.size() - 1, static_cast<std::size_t>(p * v.size()));
+	std::nth_element(v.begin(), v.begin() + i, v.end());
+	return v[i];
+}
+
+/* server process */
+struct ProcessSample {
+	double cpu_seconds = 0;
+	double rss_mib = 0;
+};
+
+ProcessSample sampleProcess(pid_t pid)
+{
+	ProcessSample ret;
+	std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+	std::string line;
+	if( std::getline(stat, line) )
+	{
+		// fields after the parenthesised command name; utime and stime are 14 and 15
+		std::istringstream ss(line.substr(line.rfind(')') + 2));
+		std::string field;
+		unsigned long utime = 0, stime = 0;
+		for(int i = 3; i <= 15 and ss >> field; ++i)
+		{
+			if( i == 14 )
+				utime = std::stoul(field);
+			if( i == 15 )
+				stime = std::stoul(field);
+		}
+		ret.cpu_seconds = double(utime + stime) / sysconf(_SC_CLK_TCK);
+	}
+	std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+	while( std::getline(status, line) )
+		if( line.rfind("VmRSS:", 0) == 0 )
+			ret.rss_mib = std::stod(line.substr(6)) / 1024;
+	return ret;
+}
+
+pid_t startServer(const Options& opt, const std::string& telemetry_dir)
+{
+	auto pid = fork();
+	if( pid == 0 )
+	{
+		auto port = std::to_string(opt.port);
+		auto speed = std::to_string(opt.sim_speed);
+		execl(opt.server.c_str(), opt.server.c_str(),
+			"--port", port.c_str(),
+			"--template_dir", opt.template_dir.c_str(),
+			"--telemetry_dir", telemetry_dir.c_str(),
+			"--sim_speed", speed.c_str(),
+			static_cast<char*>(nullptr));
+		std::perror("exec");
+		std::_Exit(127);
+	}
+	return pid;
+}
+
+void stopServer(const Options& opt, pid_t pid)
+{
+	Connection c(opt.host, opt.port);
+	Response res;
+	c.get("/quit", res);
+	for(int i = 0; i < 50; ++i)
+	{
+		if( waitpid(pid, nullptr, WNOHANG) == pid )
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	std::cerr << "server didnt quit, killing it" << std::endl;
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+}
+
+/* what the page does */
+struct Site {
+	std::vector<std::string> status_roots; // aggregate status endpoints
+	std::vector<std::string> graphs;       // temperature sensors
+	std::vector<std::string> lists;        // polled selects
+};
+
+Site discover(const std::vector<std::string>& routes)
+{
+	Site site;
+	auto ends_with = [](const std::string& s, const std::string& suffix) {
+		return s.size() >= suffix.size() and s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	};
+	std::vector<std::string> status_prefixes;
+	for(auto&& r : routes)
+	{
+		if( ends_with(r, "/history") )
+			site.graphs.push_back(r.substr(0, r.size() - 8));
+		if( ends_with(r, "/list") )
+			site.lists.push_back(r);
+		if( ends_with(r, "/status") )
+			status_prefixes.push_back(r.substr(0, r.size() - 7));
+	}
+	// the outermost status endpoints of the component tree are the aggregate ones
+	std::sort(status_prefixes.begin(), status_prefixes.end());
+	for(auto&& p : status_prefixes)
+	{
+		if( p.empty() or p.find('/', 1) != std::string::npos )
+			continue;
+		bool covers_graph = std::any_of(site.graphs.begin(), site.graphs.end(),
+			[&](const std::string& g){return g.rfind(p + "/", 0) == 0;});
+		if( covers_graph )
+			site.status_roots.push_back(p);
+	}
+	return site;
+}
+
+// the number following "key": after each of path's components in turn; good
+// enough for the status JSON this server produces
+bool findNumber(const std::string& json, const std::vector<std::string>& path, const std::string& key, double& out)
+{
+	std::size_t pos = 0;
+	for(auto&& p : path)
+	{
+		pos = json.find("\"" + p + "\":", pos);
+		if( pos == std::string::npos )
+			return false;
+	}
+	pos = json.find("\"" + key + "\":", pos);
+	if( pos == std::string::npos )
+		return false;
+	out = std::strtod(json.c_str() + pos + key.size() + 3, nullptr);
+	return true;
+}
+
+std::vector<std::string> split(const std::string& s, char sep)
+{
+	std::vector<std::string> ret;
+	std::stringstream ss(s);
+	std::string part;
+	while( std::getline(ss, part, sep) )
+		if( not part.empty() )
+			ret.push_back(part);
+	return ret;
+}
+
+void runClient(const Options& opt, const Site& site, Stats& stats, std::atomic<bool>& done, unsigned seed)
+{
+	Connection conn(opt.host, opt.port);
+	auto fetch = [&](const std::string& kind, const std::string& path, Response& res) {
+		auto start = clock::now();
+		bool ok = conn.get(path, res);
+		auto ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		if( not ok )
+			stats.error(kind + ": no response");
+		else if( res.code >= 400 )
+			stats.error(kind + ": http " + std::to_string(res.code));
+		else
+		{
+			stats.record(kind, ms);
+			return true;
+		}
+		return false;
+	};
+
+	// stagger clients the way people open the page at different times
+	std::this_thread::sleep_for(std::chrono::milliseconds(seed * 997 % 1000));
+
+	Response res;
+	if( fetch("page", "/", res) )
+	{
+		static const std::regex asset(R"((assets/[^"']+))");
+		for(std::sregex_iterator it(res.body.begin(), res.body.end(), asset), end; it != end; ++it)
+		{
+			Response a;
+			fetch("asset", "/" + (*it)[1].str(), a);
+		}
+	}
+	std::map<std::string, std::size_t> next_index;
+	for(auto&& g : site.graphs)
+	{
+		double next = 0;
+		if( fetch("history", g + "/history", res) and findNumber(res.body, {}, "next", next) )
+			next_index[g] = static_cast<std::size_t>(next);
+	}
+
+	auto next_status = clock::now();
+	auto next_graphs = clock::now();
+	auto next_lists = clock::now();
+	std::map<std::string, std::string> last_status;
+	std::map<std::string, std::string> list_versions;
+	while( not done )
+	{
+		auto now = clock::now();
+		if( now >= next_status )
+		{
+			for(auto&& root : site.status_roots)
+				if( fetch("status", root + "/status", res) )
+					last_status[root] = res.body;
+			next_status += std::chrono::seconds(1);
+		}
+		if( now >= next_graphs )
+		{
+			for(auto&& g : site.graphs)
+			{
+				// the graph only asks for points once the status shows there are new ones
+				for(auto&& root : site.status_roots)
+				{
+					if( g.rfind(root + "/", 0) != 0 )
+						continue;
+					double size = 0;
+					if( findNumber(last_status[root], split(g.substr(root.size()), '/'), "size", size) and size > next_index[g] )
+						if( fetch("graph", g + "/status/" + std::to_string(next_index[g]), res) )
+							next_index[g] = static_cast<std::size_t>(size);
+				}
+			}
+			next_graphs += std::chrono::seconds(2);
+		}
+		if( now >= next_lists )
+		{
+			// like the page, only asking for the list again once its version moves
+			for(auto&& l : site.lists)
+			{
+				double version = 0;
+				if( fetch("list", l + "?version=" + list_versions[l], res) and res.body.find("\"devices\"") != std::string::npos and findNumber(res.body, {}, "version", version) )
+					list_versions[l] = std::to_string(static_cast<std::uint64_t>(version));
+			}
+			next_lists += std::chrono::seconds(5);
+		}
+		std::this_thread::sleep_until(std::min({next_status, next_graphs, next_lists}));
+	}
+}
+
+// the whole of s as a whole number from min to max; out is left alone otherwise
+bool parseCount(const std::string& s, long long min, long long max, unsigned& out)
+{
+	std::stringstream ss(s);
+	long long v;
+	char junk;
+	if( not (ss >> v) or ss >> junk or v < min or v > max )
+		return false;
+	out = v;
+	return true;
+}
+
+bool parseSpeed(const std::string& s, double& out)
+{
+	std::stringstream ss(s);
+	double v;
+	char junk;
+	if( not (ss >> v) or ss >> junk or not std::isfinite(v) or v <= 0 )
+		return false;
+	out = v;
+	return true;
+}
+
+void usage(const char* name)
+{
+	std::cerr << "usage: " << name << " [options]\n"
+		"  --server PATH        run_brewery (mock build) to start; otherwise use a running one\n"
+		"  --template_dir DIR   passed to the server (default .)\n"
+		"  --host ADDR          (default 127.0.0.1)\n"
+		"  --port N             1 to 65535 (default 40180)\n"
+		"  --clients N          simulated browsers, 1 to 10000 (default 10)\n"
+		"  --duration S         soak length in seconds, at least 1 (default 60)\n"
+		"  --report S           seconds between reports, at least 1 (default 10)\n"
+		"  --sim_speed X        passed to the server, above 0 (default 10)\n";
+}
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	for(int arg = 1; arg < argc; ++arg)
+	{
+		std::string argstr = argv[arg];
+		if( arg+1 >= argc )
+		{
+			usage(argv[0]);
+			return -1;
+		}
+		std::string value = argv[++arg];
+		constexpr long long MaxSeconds = std::numeric_limits<unsigned>::max();
+		bool ok = true;
+		if( argstr == "--server" )
+			opt.server = value;
+		else if( argstr == "--template_dir" )
+			opt.template_dir = value;
+		else if( argstr == "--host" )
+			opt.host = value;
+		else if( argstr == "--port" )
+			ok = parseCount(value, 1, 65535, opt.port);
+		else if( argstr == "--clients" )
+			ok = parseCount(value, 1, 10000, opt.clients);
+		else if( argstr == "--duration" )
+			ok = parseCount(value, 1, MaxSeconds, opt.duration);
+		else if( argstr == "--report" )
+			ok = parseCount(value, 1, MaxSeconds, opt.report);
+		else if( argstr == "--sim_speed" )
+			ok = parseSpeed(value, opt.sim_speed);
+		else
+			ok = false;
+		if( not ok )
+		{
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	pid_t server = 0;
+	std::string telemetry_dir;
+	if( not opt.server.empty() )
+	{
+		char tmpl[] = "/tmp/loadgen_telemetryXXXXXX";
+		if( mkdtemp(tmpl) == nullptr )
+		{
+			std::perror("mkdtemp");
+			return -1;
+		}
+		telemetry_dir = tmpl;
+		server = startServer(opt, telemetry_dir);
+	}
+
+	// wait for it to come up and tell us what it serves
+	Response routes;
+	bool up = false;
+	for(int i = 0; i < 300 and not up; ++i)
+	{
+		Connection c(opt.host, opt.port);
+		up = c.get("/routes", routes) and routes.code == 200;
+		if( not up )
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	if( not up )
+	{
+		std::cerr << "server at " << opt.host << ":" << opt.port << " didnt answer /routes" << std::endl;
+		if( server )
+			stopServer(opt, server);
+		return -1;
+	}
+	std::vector<std::string> route_list;
+	static const std::regex quoted("\"([^\"]*)\"");
+	for(std::sregex_iterator it(routes.body.begin(), routes.body.end(), quoted), end; it != end; ++it)
+		route_list.push_back((*it)[1].str());
+	auto site = discover(route_list);
+	std::cout << route_list.size() << " routes; " << site.status_roots.size() << " status roots, "
+		<< site.graphs.size() << " graphs, " << site.lists.size() << " lists; "
+		<< opt.clients << " clients for " << opt.duration << "s" << std::endl;
+
+	Stats stats;
+	std::atomic<bool> done{false};
+	std::vector<std::thread> clients;
+	for(unsigned i = 0; i < opt.clients; ++i)
+		clients.emplace_back([&, i]{runClient(opt, site, stats, done, i);});
+
+	auto start = clock::now();
+	auto first = server ? sampleProcess(server) : ProcessSample{};
+	auto last = first;
+	auto last_time = start;
+	double peak_rss = first.rss_mib;
+	for(auto next = start + std::chrono::seconds(opt.report); next <= start + std::chrono::seconds(opt.duration); next += std::chrono::seconds(opt.report))
+	{
+		std::this_thread::sleep_until(next);
+		std::vector<double> interval;
+		std::size_t errors;
+		{
+			std::lock_guard<std::mutex> g{stats.mut};
+			interval.swap(stats.latencies_ms);
+			stats.all_latencies_ms.insert(stats.all_latencies_ms.end(), interval.begin(), interval.end());
+			errors = stats.total_errors;
+		}
+		auto now = clock::now();
+		double secs = std::chrono::duration<double>(now - last_time).count();
+		std::printf("[%5.0fs] %8.1f req/s  p50 %7.2fms  p99 %7.2fms  p999 %7.2fms  errors %zu",
+			std::chrono::duration<double>(now - start).count(), interval.size() / secs,
+			percentile(interval, 0.5), percentile(interval, 0.99), percentile(interval, 0.999), errors);
+		if( server )
+		{
+			auto p = sampleProcess(server);
+			peak_rss = std::max(peak_rss, p.rss_mib);
+			std::printf("  server cpu %5.1f%%  rss %6.1f MiB", (p.cpu_seconds - last.cpu_seconds) / secs * 100, p.rss_mib);
+			last = p;
+		}
+		std::printf("\n");
+		std::fflush(stdout);
+		last_time = now;
+	}
+	// the rest of a duration that isnt a whole number of reports
+	std::this_thread::sleep_until(start + std::chrono::seconds(opt.duration));
+	done = true;
+	for(auto&& c : clients)
+		c.join();
+	auto total_secs = std::chrono::duration<double>(clock::now() - start).count();
+	// requests since the last report, which would otherwise be left out of the totals
+	stats.all_latencies_ms.insert(stats.all_latencies_ms.end(), stats.latencies_ms.begin(), stats.latencies_ms.end());
+	stats.latencies_ms.clear();
+	if( server )
+	{
+		last = sampleProcess(server);
+		peak_rss = std::max(peak_rss, last.rss_mib);
+	}
+
+	std::cout << "\nper request kind:\n";
+	for(auto&& k : stats.by_kind_ms)
+		std::printf("  %-8s %8zu  p50 %7.2fms  p99 %7.2fms  p999 %7.2fms\n", k.first.c_str(), k.second.size(),
+			percentile(k.second, 0.5), percentile(k.second, 0.99), percentile(k.second, 0.999));
+	std::printf("total: %zu requests, %.1f req/s, p50 %.2fms p99 %.2fms p999 %.2fms\n", stats.all_latencies_ms.size(),
+		stats.all_latencies_ms.size() / total_secs, percentile(stats.all_latencies_ms, 0.5),
+		percentile(stats.all_latencies_ms, 0.99), percentile(stats.all_latencies_ms, 0.999));
+	std::printf("errors: %zu\n", stats.total_errors);
+	for(auto&& e : stats.errors)
+		std::printf("  %s: %zu\n", e.first.c_str(), e.second);
+	if( server )
+	{
+		std::printf("server: %.1fs cpu (%.1f%% avg), rss %.1f MiB at start, %.1f at end, %.1f peak\n",
+			last.cpu_seconds - first.cpu_seconds, (last.cpu_seconds - first.cpu_seconds) / total_secs * 100,
+			first.rss_mib, last.rss_mib, peak_rss);
+		stopServer(opt, server);
+		std::string rm = "rm -rf '" + telemetry_dir + "'";
+		if( std::system(rm.c_str()) != 0 )
+			std::cerr << "couldnt remove " << telemetry_dir << std::endl;
+	}
+	return stats.total_errors ? 1 : 0;
+}